@@ -0,0 +1,343 @@
+/*
+ * bcast.c - single-writer broadcast ring buffer.
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+#include "bcast.h"
+#include "ringbuf_common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Reader slot states */
+enum
+{
+	BCAST_READER_FREE,
+	BCAST_READER_CLAIMED,
+	BCAST_READER_ACTIVE,
+	BCAST_READER_LOSSY,
+};
+
+/*
+ * One reader, on its own cache line: cursor is the counter of the next
+ * byte it reads, and back_cache its cached copy of the producer's back.
+ */
+struct bcast_reader
+{
+	alignas( RINGBUF_CACHELINE ) atomic_size_t cursor;
+	atomic_int state;
+	size_t back_cache;
+};
+
+/*
+ * back counts the bytes written. claim is set to the end of a write
+ * before any of it is copied into the buffer; a lossy reader compares
+ * it with its cursor after copying to find out whether the producer
+ * may have overwritten what it copied (as in a seqlock).
+ *
+ * min_cache is the producer's cached cursor of the slowest normal
+ * reader (or back, when there is none). The producer only rescans the
+ * reader slots when the cached value claims there is too little room.
+ */
+struct bcast_ring_t
+{
+	uint8_t *buf;
+	size_t mask;
+	int max_readers;
+	struct bcast_reader *readers;
+
+	/* Producer state */
+	alignas( RINGBUF_CACHELINE ) atomic_size_t back;
+	atomic_size_t claim;
+	size_t min_cache;
+};
+
+bcast_ring_t *bcast_ring_new( size_t capacity, int max_readers )
+{
+	assert( max_readers > 0 );
+	bcast_ring_t *r = aligned_alloc( alignof( bcast_ring_t ), sizeof( bcast_ring_t ) );
+	if ( r )
+	{
+		size_t size = ringbuf_pow2_ceil( capacity );
+		if ( size == 0 || ( size_t )max_readers > SIZE_MAX / sizeof( struct bcast_reader ) )
+		{
+			free( r );
+			errno = EINVAL;
+			return NULL;
+		}
+
+		r->mask = size - 1;
+		r->max_readers = max_readers;
+		r->buf = malloc( size );
+		r->readers = aligned_alloc( alignof( struct bcast_reader ), max_readers * sizeof( struct bcast_reader ) );
+		if ( !r->buf || !r->readers )
+		{
+			free( r->buf );
+			free( r->readers );
+			free( r );
+			return NULL;
+		}
+
+		atomic_init( &r->back, 0 );
+		atomic_init( &r->claim, 0 );
+		r->min_cache = 0;
+		for ( int i = 0; i < max_readers; ++i )
+		{
+			atomic_init( &r->readers[ i ].cursor, 0 );
+			atomic_init( &r->readers[ i ].state, BCAST_READER_FREE );
+			r->readers[ i ].back_cache = 0;
+		}
+	}
+	return r;
+}
+
+void bcast_ring_free( bcast_ring_t *r )
+{
+	assert( r );
+	free( r->buf );
+	free( r->readers );
+	free( r );
+}
+
+size_t bcast_ring_capacity( const bcast_ring_t *r )
+{
+	return r->mask + 1;
+}
+
+/*
+ * A new normal reader first shows up with a cursor of some recent
+ * back, then, after a full fence, moves its cursor to back as it is
+ * now. The producer fences before it scans the readers, so either the
+ * scan sees the new reader, or the reader's second look at back sees
+ * everything the producer published before that scan; since the
+ * producer only ever writes up to a capacity past the minimum it
+ * scanned, which is at most that back, nothing the reader starts at
+ * can be overwritten in the meantime.
+ */
+int bcast_ring_reader_add( bcast_ring_t *r, int flags )
+{
+	for ( int i = 0; i < r->max_readers; ++i )
+	{
+		struct bcast_reader *rd = &r->readers[ i ];
+		int state = BCAST_READER_FREE;
+		if ( !atomic_compare_exchange_strong( &rd->state, &state, BCAST_READER_CLAIMED ) )
+			continue;
+
+		size_t back = atomic_load_explicit( &r->back, memory_order_acquire );
+		atomic_store_explicit( &rd->cursor, back, memory_order_relaxed );
+		rd->back_cache = back;
+		atomic_store( &rd->state, flags & BCAST_RING_LOSSY ? BCAST_READER_LOSSY : BCAST_READER_ACTIVE );
+		atomic_thread_fence( memory_order_seq_cst );
+
+		back = atomic_load_explicit( &r->back, memory_order_acquire );
+		atomic_store_explicit( &rd->cursor, back, memory_order_release );
+		rd->back_cache = back;
+		return i;
+	}
+	return -1;
+}
+
+void bcast_ring_reader_remove( bcast_ring_t *r, int reader )
+{
+	assert( reader >= 0 && reader < r->max_readers );
+	atomic_store_explicit( &r->readers[ reader ].state, BCAST_READER_FREE, memory_order_release );
+}
+
+/*
+ * Find the cursor of the slowest normal reader. Distances from back
+ * are compared rather than cursors, so that counter wrap-around does
+ * not matter.
+ */
+static size_t bcast_ring_min_cursor( bcast_ring_t *r, size_t back )
+{
+	size_t min = back;
+	atomic_thread_fence( memory_order_seq_cst );
+	for ( int i = 0; i < r->max_readers; ++i )
+	{
+		struct bcast_reader *rd = &r->readers[ i ];
+		if ( atomic_load_explicit( &rd->state, memory_order_acquire ) != BCAST_READER_ACTIVE )
+			continue;
+		size_t cursor = atomic_load_explicit( &rd->cursor, memory_order_acquire );
+
+		/* a reader still being added may show a stale cursor */
+		if ( back - cursor > bcast_ring_capacity( r ) )
+			cursor = back - bcast_ring_capacity( r );
+		if ( back - cursor > back - min )
+			min = cursor;
+	}
+	return min;
+}
+
+/* Producer side free space, rescanning the readers if needed. */
+static size_t bcast_ring_producer_free( bcast_ring_t *r, size_t back, size_t count )
+{
+	size_t nfree = bcast_ring_capacity( r ) - ( back - r->min_cache );
+	if ( nfree < count )
+	{
+		r->min_cache = bcast_ring_min_cursor( r, back );
+		nfree = bcast_ring_capacity( r ) - ( back - r->min_cache );
+	}
+	return nfree;
+}
+
+/*
+ * Split count bytes starting at counter i where the ring wraps.
+ */
+static void bcast_ring_spans( const bcast_ring_t *r, size_t i, size_t count, bcast_span_t span[ 2 ] )
+{
+	size_t n = ringbuf_min( bcast_ring_capacity( r ) - ( i & r->mask ), count );
+	span[ 0 ].data = r->buf + ( i & r->mask );
+	span[ 0 ].len = n;
+	span[ 1 ].data = r->buf;
+	span[ 1 ].len = count - n;
+}
+
+size_t bcast_ring_bytes_free( bcast_ring_t *r )
+{
+	size_t back = atomic_load_explicit( &r->back, memory_order_relaxed );
+	return bcast_ring_producer_free( r, back, bcast_ring_capacity( r ) );
+}
+
+size_t bcast_ring_write_reserve( bcast_ring_t *r, size_t count, bcast_span_t span[ 2 ] )
+{
+	size_t back = atomic_load_explicit( &r->back, memory_order_relaxed );
+	size_t nfree = bcast_ring_producer_free( r, back, count );
+	count = ringbuf_min( count, nfree );
+
+	/* tell lossy readers what is about to be overwritten */
+	atomic_store_explicit( &r->claim, back + count, memory_order_relaxed );
+	atomic_thread_fence( memory_order_release );
+
+	bcast_ring_spans( r, back, count, span );
+	return count;
+}
+
+void bcast_ring_write_commit( bcast_ring_t *r, size_t count )
+{
+	size_t back = atomic_load_explicit( &r->back, memory_order_relaxed );
+	assert( count <= atomic_load_explicit( &r->claim, memory_order_relaxed ) - back );
+	atomic_store_explicit( &r->back, back + count, memory_order_release );
+}
+
+size_t bcast_ring_write( bcast_ring_t *r, const void *src, size_t count )
+{
+	bcast_span_t span[ 2 ];
+	count = bcast_ring_write_reserve( r, count, span );
+	memcpy( span[ 0 ].data, src, span[ 0 ].len );
+	memcpy( span[ 1 ].data, ( const uint8_t * )src + span[ 0 ].len, span[ 1 ].len );
+	bcast_ring_write_commit( r, count );
+	return count;
+}
+
+size_t bcast_ring_bytes_used( bcast_ring_t *r, int reader )
+{
+	struct bcast_reader *rd = &r->readers[ reader ];
+	size_t cursor = atomic_load_explicit( &rd->cursor, memory_order_relaxed );
+	return atomic_load_explicit( &r->back, memory_order_acquire ) - cursor;
+}
+
+/* Reader side unread bytes, refreshing the cached back if needed. */
+static size_t bcast_ring_reader_used( bcast_ring_t *r, struct bcast_reader *rd, size_t cursor, size_t count )
+{
+	size_t nused = rd->back_cache - cursor;
+	if ( nused < count )
+	{
+		rd->back_cache = atomic_load_explicit( &r->back, memory_order_acquire );
+		nused = rd->back_cache - cursor;
+	}
+	return nused;
+}
+
+static void bcast_ring_copy_out( const bcast_ring_t *r, size_t cursor, void *dst, size_t count )
+{
+	bcast_span_t span[ 2 ];
+	bcast_ring_spans( r, cursor, count, span );
+	memcpy( dst, span[ 0 ].data, span[ 0 ].len );
+	memcpy( ( uint8_t * )dst + span[ 0 ].len, span[ 1 ].data, span[ 1 ].len );
+}
+
+/*
+ * A lossy reader copies first and checks afterwards: if the producer
+ * had claimed a byte a whole ring past the cursor by the time the copy
+ * finished, the oldest bytes copied may be torn, so the copy is thrown
+ * away and the reader skips to the newest data.
+ */
+static size_t bcast_ring_read_lossy( bcast_ring_t *r, struct bcast_reader *rd, void *dst, size_t count, size_t *lost )
+{
+	size_t capacity = bcast_ring_capacity( r );
+	size_t cursor = atomic_load_explicit( &rd->cursor, memory_order_relaxed );
+	size_t nlost = 0, n;
+
+	for ( ;; )
+	{
+		size_t back = atomic_load_explicit( &r->back, memory_order_acquire );
+		if ( back - cursor > capacity )
+		{
+			nlost += back - cursor;
+			cursor = back;
+		}
+
+		n = ringbuf_min( count, back - cursor );
+		if ( n == 0 )
+			break;
+		bcast_ring_copy_out( r, cursor, dst, n );
+
+		atomic_thread_fence( memory_order_acquire );
+		if ( atomic_load_explicit( &r->claim, memory_order_relaxed ) - cursor <= capacity )
+			break;
+
+		back = atomic_load_explicit( &r->back, memory_order_acquire );
+		nlost += back - cursor;
+		cursor = back;
+	}
+
+	atomic_store_explicit( &rd->cursor, cursor + n, memory_order_release );
+	if ( lost )
+		*lost = nlost;
+	return n;
+}
+
+size_t bcast_ring_read( bcast_ring_t *r, int reader, void *dst, size_t count, size_t *lost )
+{
+	assert( reader >= 0 && reader < r->max_readers );
+	struct bcast_reader *rd = &r->readers[ reader ];
+	if ( atomic_load_explicit( &rd->state, memory_order_relaxed ) == BCAST_READER_LOSSY )
+		return bcast_ring_read_lossy( r, rd, dst, count, lost );
+
+	size_t cursor = atomic_load_explicit( &rd->cursor, memory_order_relaxed );
+	size_t used = bcast_ring_reader_used( r, rd, cursor, count );
+	count = ringbuf_min( count, used );
+	bcast_ring_copy_out( r, cursor, dst, count );
+	atomic_store_explicit( &rd->cursor, cursor + count, memory_order_release );
+	if ( lost )
+		*lost = 0;
+	return count;
+}
+
+size_t bcast_ring_read_peek( bcast_ring_t *r, int reader, size_t count, bcast_span_t span[ 2 ] )
+{
+	assert( reader >= 0 && reader < r->max_readers );
+	struct bcast_reader *rd = &r->readers[ reader ];
+	assert( atomic_load_explicit( &rd->state, memory_order_relaxed ) == BCAST_READER_ACTIVE );
+
+	size_t cursor = atomic_load_explicit( &rd->cursor, memory_order_relaxed );
+	size_t used = bcast_ring_reader_used( r, rd, cursor, count );
+	count = ringbuf_min( count, used );
+	bcast_ring_spans( r, cursor, count, span );
+	return count;
+}
+
+void bcast_ring_read_consume( bcast_ring_t *r, int reader, size_t count )
+{
+	assert( reader >= 0 && reader < r->max_readers );
+	struct bcast_reader *rd = &r->readers[ reader ];
+	size_t cursor = atomic_load_explicit( &rd->cursor, memory_order_relaxed );
+	assert( count <= bcast_ring_reader_used( r, rd, cursor, count ) );
+	atomic_store_explicit( &rd->cursor, cursor + count, memory_order_release );
+}
@@ -0,0 +1,136 @@
+#ifndef INCLUDED_BCAST_H
+#define INCLUDED_BCAST_H
+
+/*
+ * bcast.c - single-writer broadcast ring buffer.
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+/*
+ * A byte ring buffer with one producer and any number of readers, up
+ * to a limit fixed at creation time. Each reader has its own cursor
+ * and sees every byte written after it was added, so one stream can
+ * be fanned out (e.g. to a disk writer, a level meter and an analyser)
+ * without copying it into a ring buffer per reader.
+ *
+ * A normal reader holds the producer back: the free space is the
+ * capacity minus what the slowest normal reader still has to read,
+ * and bcast_ring_write is cut short when it runs out, exactly like
+ * an SPSC ringbuf_t. A reader added with BCAST_RING_LOSSY never
+ * limits the producer; when it falls more than the capacity behind,
+ * the data it missed is skipped and reported, and it carries on from
+ * the newest data.
+ *
+ * The producer, and each reader, may run on its own thread without
+ * locks. Readers may be added and removed while the producer runs.
+ * The capacity is a power of two, and the cursors are byte counters
+ * that only ever grow and are masked into the buffer.
+ */
+
+#include <stddef.h>
+
+typedef struct bcast_ring_t bcast_ring_t;
+
+/*
+ * A contiguous region of the buffer, as returned by
+ * bcast_ring_write_reserve and bcast_ring_read_peek.
+ */
+typedef struct bcast_span_t
+{
+	void *data;
+	size_t len;
+} bcast_span_t;
+
+/* Reader flag for bcast_ring_reader_add */
+#define BCAST_RING_LOSSY 0x01
+
+/*
+ * Create a new broadcast ring of at least capacity bytes (rounded up
+ * to a power of two) that up to max_readers readers may be attached to.
+ *
+ * Returns the new ring, or 0 if there's not enough memory (or the size
+ * asked for is too large, with errno set to EINVAL).
+ */
+bcast_ring_t *bcast_ring_new( size_t capacity, int max_readers );
+
+/*
+ * Deallocate a broadcast ring. No other thread may be using it.
+ */
+void bcast_ring_free( bcast_ring_t *r );
+
+size_t bcast_ring_capacity( const bcast_ring_t *r );
+
+/*
+ * Add a reader, which starts reading at the data written after this
+ * call. flags may be BCAST_RING_LOSSY (see above). May be called from
+ * any thread.
+ *
+ * Returns the reader's id, to pass to the read functions, or -1 if
+ * max_readers readers are already attached.
+ */
+int bcast_ring_reader_add( bcast_ring_t *r, int flags );
+
+/*
+ * Remove a reader. Its slot may be reused by a later
+ * bcast_ring_reader_add. Only the reader's own thread may call this.
+ */
+void bcast_ring_reader_remove( bcast_ring_t *r, int reader );
+
+/*
+ * The number of bytes the producer may write before it has to wait
+ * for the slowest normal reader. Producer side.
+ */
+size_t bcast_ring_bytes_free( bcast_ring_t *r );
+
+/*
+ * Copy up to count bytes from src into the ring. Returns the number of
+ * bytes copied, which is less than count only if the slowest normal
+ * reader is less than count bytes from being a full ring behind.
+ */
+size_t bcast_ring_write( bcast_ring_t *r, const void *src, size_t count );
+
+/*
+ * Zero-copy writing, as for ringbuf_write_reserve: describe up to
+ * count free bytes as at most two spans, split where the ring wraps,
+ * and return how many bytes they cover; then commit the number of
+ * bytes written into them.
+ */
+size_t bcast_ring_write_reserve( bcast_ring_t *r, size_t count, bcast_span_t span[ 2 ] );
+
+void bcast_ring_write_commit( bcast_ring_t *r, size_t count );
+
+/*
+ * The number of bytes the reader has not read yet. For a lossy reader
+ * this may exceed the capacity, when the reader has been overrun.
+ */
+size_t bcast_ring_bytes_used( bcast_ring_t *r, int reader );
+
+/*
+ * Copy up to count of the reader's unread bytes into dst and move its
+ * cursor past them. Returns the number of bytes copied, which is less
+ * than count only if the reader caught up with the producer.
+ *
+ * If lost is not 0 it receives the number of bytes that a lossy reader
+ * skipped because the producer overwrote them before they were read
+ * (always 0 for a normal reader).
+ */
+size_t bcast_ring_read( bcast_ring_t *r, int reader, void *dst, size_t count, size_t *lost );
+
+/*
+ * Zero-copy reading for a normal reader, as for ringbuf_read_peek:
+ * describe up to count unread bytes as at most two spans, then consume
+ * the number of bytes that were dealt with. The producer cannot
+ * overwrite the spans until they are consumed. Not available to lossy
+ * readers, whose data may be overwritten at any time.
+ */
+size_t bcast_ring_read_peek( bcast_ring_t *r, int reader, size_t count, bcast_span_t span[ 2 ] );
+
+void bcast_ring_read_consume( bcast_ring_t *r, int reader, size_t count );
+
+// Include the implementation for a "header only" version of the library
+#ifdef BCAST_RING_IMPLEMENTATION
+#include "bcast.c"
+#endif
+
+#endif /* INCLUDED_BCAST_H */
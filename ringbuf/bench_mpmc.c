@@ -0,0 +1,221 @@
+/*
+ * bench_mpmc.c - scaling benchmark for mpmc_queue_t.
+ *
+ * Moves a fixed number of 16 byte items from P producer threads to P
+ * consumer threads, for P = 1 .. max_threads, through
+ *
+ *   mutex_ringbuf  a ringbuf_t guarded by a pthread mutex
+ *   mpmc           mpmc_queue_push/mpmc_queue_pop
+ *   mpmc_batch     mpmc_queue_push_batch/mpmc_queue_pop_batch
+ *
+ * and prints one CSV line per run.
+ *
+ * usage: bench_mpmc [max_threads] [items]
+ */
+
+#include "mpmc.h"
+#include "ringbuf.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define QUEUE_SLOTS 1024
+#define BATCH 32
+
+typedef struct item_t
+{
+	uint64_t value;
+	uint64_t pad;
+} item_t;
+
+typedef struct impl_t
+{
+	const char *name;
+	int lock_free;
+	size_t batch;
+} impl_t;
+
+typedef struct bench_t
+{
+	const impl_t *impl;
+	size_t items;
+	int threads;
+
+	mpmc_queue_t *q;
+	ringbuf_t *rb;
+	pthread_mutex_t lock;
+
+	atomic_size_t popped;
+	atomic_uint_fast64_t sum;
+} bench_t;
+
+typedef struct worker_t
+{
+	bench_t *b;
+	size_t first, count;
+} worker_t;
+
+static double now( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t push_items( bench_t *b, const item_t *items, size_t n )
+{
+	if ( b->q )
+	{
+		if ( n == 1 )
+			return mpmc_queue_push( b->q, items );
+		return mpmc_queue_push_batch( b->q, items, n );
+	}
+
+	size_t pushed = 0;
+	pthread_mutex_lock( &b->lock );
+	if ( ringbuf_bytes_free( b->rb ) >= sizeof( item_t ) )
+	{
+		ringbuf_push_back( b->rb, items, sizeof( item_t ) );
+		pushed = 1;
+	}
+	pthread_mutex_unlock( &b->lock );
+	return pushed;
+}
+
+static size_t pop_items( bench_t *b, item_t *items, size_t n )
+{
+	if ( b->q )
+	{
+		if ( n == 1 )
+			return mpmc_queue_pop( b->q, items );
+		return mpmc_queue_pop_batch( b->q, items, n );
+	}
+
+	pthread_mutex_lock( &b->lock );
+	size_t popped = ringbuf_pop_front( items, b->rb, sizeof( item_t ) ) != NULL;
+	pthread_mutex_unlock( &b->lock );
+	return popped;
+}
+
+static void *producer( void *arg )
+{
+	worker_t *w = arg;
+	size_t batch = w->b->impl->batch;
+	item_t items[ BATCH ] = { { 0, 0 } };
+	size_t next = w->first, end = w->first + w->count;
+
+	while ( next != end )
+	{
+		size_t n = end - next < batch ? end - next : batch;
+		for ( size_t i = 0; i < n; ++i )
+			items[ i ].value = next + i;
+
+		size_t pushed = 0;
+		while ( pushed != n )
+		{
+			size_t k = push_items( w->b, items + pushed, n - pushed );
+			if ( k == 0 )
+				sched_yield();
+			pushed += k;
+		}
+		next += n;
+	}
+	return NULL;
+}
+
+static void *consumer( void *arg )
+{
+	worker_t *w = arg;
+	bench_t *b = w->b;
+	size_t batch = b->impl->batch;
+	item_t items[ BATCH ];
+	uint64_t sum = 0;
+
+	while ( atomic_load_explicit( &b->popped, memory_order_relaxed ) < b->items )
+	{
+		size_t n = pop_items( b, items, batch );
+		if ( n == 0 )
+		{
+			sched_yield();
+			continue;
+		}
+		for ( size_t i = 0; i < n; ++i )
+			sum += items[ i ].value;
+		atomic_fetch_add_explicit( &b->popped, n, memory_order_relaxed );
+	}
+	atomic_fetch_add( &b->sum, sum );
+	return NULL;
+}
+
+static int run( const impl_t *impl, int threads, size_t items )
+{
+	bench_t b = { .impl = impl, .items = items, .threads = threads };
+	pthread_t tid[ 2 * threads ];
+	worker_t w[ 2 * threads ];
+
+	if ( impl->lock_free )
+		b.q = mpmc_queue_new( sizeof( item_t ), QUEUE_SLOTS );
+	else
+	{
+		b.rb = ringbuf_new( QUEUE_SLOTS * sizeof( item_t ) );
+		pthread_mutex_init( &b.lock, NULL );
+	}
+	if ( !b.q && !b.rb )
+		return -1;
+	atomic_init( &b.popped, 0 );
+	atomic_init( &b.sum, 0 );
+
+	double start = now();
+	for ( int i = 0; i < threads; ++i )
+	{
+		w[ i ] = ( worker_t ){ &b, items * i / threads, items * ( i + 1 ) / threads - items * i / threads };
+		w[ threads + i ] = ( worker_t ){ &b, 0, 0 };
+		pthread_create( &tid[ i ], NULL, producer, &w[ i ] );
+		pthread_create( &tid[ threads + i ], NULL, consumer, &w[ threads + i ] );
+	}
+	for ( int i = 0; i < 2 * threads; ++i )
+		pthread_join( tid[ i ], NULL );
+	double elapsed = now() - start;
+
+	uint64_t expected = ( uint64_t )items * ( items - 1 ) / 2;
+	int ok = atomic_load( &b.sum ) == expected;
+	printf( "%s,%d,%zu,%zu,%.6f,%.3f,%s\n", impl->name, threads, items, sizeof( item_t ), elapsed,
+		items / elapsed / 1e6, ok ? "ok" : "CORRUPT" );
+	fflush( stdout );
+
+	if ( b.q )
+		mpmc_queue_free( b.q );
+	else
+	{
+		ringbuf_free( b.rb );
+		pthread_mutex_destroy( &b.lock );
+	}
+	return ok ? 0 : -1;
+}
+
+int main( int argc, char **argv )
+{
+	int max_threads = argc > 1 ? atoi( argv[ 1 ] ) : ( int )sysconf( _SC_NPROCESSORS_ONLN );
+	size_t items = argc > 2 ? strtoul( argv[ 2 ], NULL, 0 ) : 2000000;
+	const impl_t impls[] = {
+		{ "mutex_ringbuf", 0, 1 },
+		{ "mpmc", 1, 1 },
+		{ "mpmc_batch", 1, BATCH },
+	};
+	int status = 0;
+
+	if ( max_threads < 1 )
+		max_threads = 1;
+
+	printf( "impl,threads,items,item_size,seconds,mitems_per_sec,check\n" );
+	for ( int t = 1; t <= max_threads; ++t )
+		for ( size_t i = 0; i < sizeof( impls ) / sizeof( impls[ 0 ] ); ++i )
+			status |= run( &impls[ i ], t, items );
+	return status ? EXIT_FAILURE : EXIT_SUCCESS;
+}
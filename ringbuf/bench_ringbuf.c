@@ -0,0 +1,301 @@
+/*
+ * bench_ringbuf.c - throughput and latency benchmarks for ringbuf_t.
+ *
+ * Runs, in order:
+ *
+ *   memcpy      two memcpy calls per chunk (in and out of a linear
+ *               buffer), the baseline for push_pop
+ *   push_pop    ringbuf_push_back + ringbuf_pop_front on one thread,
+ *               chunk sizes from 1 B to 1 MiB
+ *   spsc        producer and consumer threads pinned to two CPUs,
+ *               moving data through an SPSC ring
+ *   pingpong    round trip latency of an 8 byte message bounced
+ *               between the two pinned threads over two SPSC rings
+ *   copy        ringbuf_copy bandwidth from one ring to another
+ *
+ * for each of the plain, power-of-two and mirrored ring variants, and
+ * prints one CSV line per result:
+ *
+ *   test,ring,chunk,metric,value
+ *
+ * usage: bench_ringbuf [total_mib] [producer_cpu] [consumer_cpu]
+ */
+
+#define _GNU_SOURCE
+
+#include "ringbuf.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_SIZE ( 2u << 20 )
+#define MAX_CHUNK ( 1u << 20 )
+#define PINGPONG_ROUNDS 100000
+#define SPIN_LIMIT 1000
+
+typedef struct variant_t
+{
+	const char *name;
+	ringbuf_t *( *make )( size_t capacity, int flags );
+} variant_t;
+
+typedef struct spsc_arg_t
+{
+	ringbuf_t *to, *from;
+	int cpu;
+	size_t chunk;
+	size_t total;
+	uint8_t *buf;
+} spsc_arg_t;
+
+static ringbuf_t *make_plain( size_t capacity, int flags )
+{
+	return flags & RINGBUF_SPSC ? ringbuf_new_spsc( capacity ) : ringbuf_new( capacity );
+}
+
+static const variant_t variants[] = {
+	{ "plain", make_plain },
+	{ "pow2", ringbuf_new_pow2 },
+	{ "mirrored", ringbuf_new_mirrored },
+};
+
+static double now( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report( const char *test, const char *ring, size_t chunk, const char *metric, double value )
+{
+	printf( "%s,%s,%zu,%s,%.3f\n", test, ring, chunk, metric, value );
+	fflush( stdout );
+}
+
+static void pin( int cpu )
+{
+	cpu_set_t set;
+	long ncpu = sysconf( _SC_NPROCESSORS_ONLN );
+	CPU_ZERO( &set );
+	CPU_SET( cpu % ( ncpu > 0 ? ncpu : 1 ), &set );
+	pthread_setaffinity_np( pthread_self(), sizeof( set ), &set );
+}
+
+/* Spin for a while before giving the CPU away, so a shared core still works */
+static void backoff( int *spins )
+{
+	if ( ++*spins > SPIN_LIMIT )
+	{
+		sched_yield();
+		*spins = 0;
+	}
+}
+
+static void bench_memcpy( uint8_t *src, uint8_t *dst, size_t total )
+{
+	uint8_t *mid = malloc( MAX_CHUNK );
+	for ( size_t chunk = 1; chunk <= MAX_CHUNK; chunk <<= 2 )
+	{
+		size_t rounds = total / chunk;
+		double start = now();
+		for ( size_t i = 0; i < rounds; ++i )
+		{
+			memcpy( mid, src, chunk );
+			__asm__ volatile( "" ::: "memory" );
+			memcpy( dst, mid, chunk );
+			__asm__ volatile( "" ::: "memory" );
+		}
+		report( "memcpy", "linear", chunk, "MB/s", rounds * chunk / ( now() - start ) / 1e6 );
+	}
+	free( mid );
+}
+
+static void bench_push_pop( const variant_t *v, uint8_t *src, uint8_t *dst, size_t total )
+{
+	ringbuf_t *rb = v->make( RING_SIZE, 0 );
+	if ( !rb )
+		return;
+
+	for ( size_t chunk = 1; chunk <= MAX_CHUNK; chunk <<= 2 )
+	{
+		size_t rounds = total / chunk;
+
+		/* offset the indices so that chunks regularly straddle the wrap */
+		ringbuf_reset( rb );
+		ringbuf_push_back( rb, src, 3 );
+		ringbuf_pop_front( dst, rb, 3 );
+
+		double start = now();
+		for ( size_t i = 0; i < rounds; ++i )
+		{
+			ringbuf_push_back( rb, src, chunk );
+			ringbuf_pop_front( dst, rb, chunk );
+		}
+		report( "push_pop", v->name, chunk, "MB/s", rounds * chunk / ( now() - start ) / 1e6 );
+	}
+	ringbuf_free( rb );
+}
+
+static void *spsc_producer( void *p )
+{
+	spsc_arg_t *a = p;
+	int spins = 0;
+	pin( a->cpu );
+	for ( size_t sent = 0; sent < a->total; )
+	{
+		if ( ringbuf_push_back( a->to, a->buf, a->chunk ) )
+			sent += a->chunk;
+		else
+			backoff( &spins );
+	}
+	return NULL;
+}
+
+static void bench_spsc( const variant_t *v, uint8_t *src, uint8_t *dst, size_t total, int cpu0, int cpu1 )
+{
+	for ( size_t chunk = 64; chunk <= 65536; chunk <<= 4 )
+	{
+		ringbuf_t *rb = v->make( RING_SIZE / 8, RINGBUF_SPSC );
+		if ( !rb )
+			return;
+
+		spsc_arg_t a = { rb, NULL, cpu0, chunk, total / chunk * chunk, src };
+		pthread_t tid;
+		int spins = 0;
+
+		pin( cpu1 );
+		double start = now();
+		pthread_create( &tid, NULL, spsc_producer, &a );
+		for ( size_t received = 0; received < a.total; )
+		{
+			if ( ringbuf_pop_front( dst, rb, chunk ) )
+				received += chunk;
+			else
+				backoff( &spins );
+		}
+		pthread_join( tid, NULL );
+		report( "spsc", v->name, chunk, "MB/s", a.total / ( now() - start ) / 1e6 );
+		ringbuf_free( rb );
+	}
+}
+
+static void *pingpong_echo( void *p )
+{
+	spsc_arg_t *a = p;
+	uint64_t msg;
+	int spins = 0;
+	pin( a->cpu );
+	for ( size_t i = 0; i < a->total; ++i )
+	{
+		while ( !ringbuf_pop_front( &msg, a->from, sizeof( msg ) ) )
+			backoff( &spins );
+		ringbuf_push_back( a->to, &msg, sizeof( msg ) );
+	}
+	return NULL;
+}
+
+static int cmp_double( const void *a, const void *b )
+{
+	double x = *( const double * )a, y = *( const double * )b;
+	return ( x > y ) - ( x < y );
+}
+
+static void bench_pingpong( const variant_t *v, int cpu0, int cpu1 )
+{
+	ringbuf_t *ping = v->make( 4096, RINGBUF_SPSC );
+	ringbuf_t *pong = v->make( 4096, RINGBUF_SPSC );
+	double *rtt = malloc( PINGPONG_ROUNDS * sizeof( *rtt ) );
+	if ( !ping || !pong || !rtt )
+		return;
+
+	spsc_arg_t a = { pong, ping, cpu1, sizeof( uint64_t ), PINGPONG_ROUNDS, NULL };
+	pthread_t tid;
+	int spins = 0;
+
+	pin( cpu0 );
+	pthread_create( &tid, NULL, pingpong_echo, &a );
+	for ( size_t i = 0; i < PINGPONG_ROUNDS; ++i )
+	{
+		uint64_t msg = i;
+		double start = now();
+		ringbuf_push_back( ping, &msg, sizeof( msg ) );
+		while ( !ringbuf_pop_front( &msg, pong, sizeof( msg ) ) )
+			backoff( &spins );
+		rtt[ i ] = ( now() - start ) * 1e9;
+	}
+	pthread_join( tid, NULL );
+
+	qsort( rtt, PINGPONG_ROUNDS, sizeof( *rtt ), cmp_double );
+	report( "pingpong", v->name, sizeof( uint64_t ), "p50_ns", rtt[ PINGPONG_ROUNDS / 2 ] );
+	report( "pingpong", v->name, sizeof( uint64_t ), "p90_ns", rtt[ PINGPONG_ROUNDS * 9 / 10 ] );
+	report( "pingpong", v->name, sizeof( uint64_t ), "p99_ns", rtt[ PINGPONG_ROUNDS * 99 / 100 ] );
+	report( "pingpong", v->name, sizeof( uint64_t ), "p999_ns", rtt[ PINGPONG_ROUNDS * 999 / 1000 ] );
+	report( "pingpong", v->name, sizeof( uint64_t ), "max_ns", rtt[ PINGPONG_ROUNDS - 1 ] );
+
+	free( rtt );
+	ringbuf_free( ping );
+	ringbuf_free( pong );
+}
+
+static void bench_copy( const variant_t *v, size_t total )
+{
+	ringbuf_t *src = v->make( RING_SIZE, 0 );
+	ringbuf_t *dst = v->make( RING_SIZE, 0 );
+	if ( !src || !dst )
+		return;
+
+	for ( size_t chunk = 64; chunk <= MAX_CHUNK; chunk <<= 4 )
+	{
+		size_t rounds = total / chunk;
+		ringbuf_reset( src );
+		ringbuf_reset( dst );
+
+		/* commit and consume move the indices without touching the data */
+		double start = now();
+		for ( size_t i = 0; i < rounds; ++i )
+		{
+			ringbuf_write_commit( src, chunk );
+			ringbuf_copy( dst, src, chunk );
+			ringbuf_read_consume( dst, chunk );
+		}
+		report( "copy", v->name, chunk, "MB/s", rounds * chunk / ( now() - start ) / 1e6 );
+	}
+	ringbuf_free( src );
+	ringbuf_free( dst );
+}
+
+int main( int argc, char **argv )
+{
+	size_t total = ( argc > 1 ? strtoul( argv[ 1 ], NULL, 0 ) : 64 ) << 20;
+	int cpu0 = argc > 2 ? atoi( argv[ 2 ] ) : 0;
+	int cpu1 = argc > 3 ? atoi( argv[ 3 ] ) : 1;
+	size_t nvariants = sizeof( variants ) / sizeof( variants[ 0 ] );
+
+	uint8_t *src = malloc( MAX_CHUNK );
+	uint8_t *dst = malloc( MAX_CHUNK );
+	if ( !src || !dst )
+		return EXIT_FAILURE;
+	memset( src, 0x5a, MAX_CHUNK );
+	memset( dst, 0, MAX_CHUNK );
+
+	printf( "test,ring,chunk,metric,value\n" );
+	bench_memcpy( src, dst, total );
+	for ( size_t i = 0; i < nvariants; ++i )
+		bench_push_pop( &variants[ i ], src, dst, total );
+	for ( size_t i = 0; i < nvariants; ++i )
+		bench_spsc( &variants[ i ], src, dst, total, cpu0, cpu1 );
+	for ( size_t i = 0; i < nvariants; ++i )
+		bench_pingpong( &variants[ i ], cpu0, cpu1 );
+	for ( size_t i = 0; i < nvariants; ++i )
+		bench_copy( &variants[ i ], total );
+
+	free( src );
+	free( dst );
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,220 @@
+/*
+ * blockpool.c - lock-free pool of fixed-size blocks.
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+#include "blockpool.h"
+#include "ringbuf_common.h"
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The index that ends a chain of free blocks */
+#define BLOCKPOOL_NIL UINT32_MAX
+
+/*
+ * Block i starts at slab + i * stride, and next[ i ] is the index of
+ * the block after it while it is free, in the shared stack or in a
+ * cache. head holds the index of the top of the shared stack in its
+ * low half and a tag, bumped by every push and pop, in its high half.
+ * The links are atomics because a thread walking the stack may read a
+ * link just as another thread that took the block reuses it; the tag
+ * then makes that thread's compare-and-swap fail.
+ */
+struct blockpool_t
+{
+	uint8_t *slab;
+	size_t block_size;
+	size_t stride;
+	uint32_t nblocks;
+	atomic_uint_least32_t *next;
+
+	/* Shared state */
+	alignas( RINGBUF_CACHELINE ) atomic_uint_least64_t head;
+};
+
+static uint64_t blockpool_pack( uint32_t index, uint64_t old )
+{
+	return ( ( old >> 32 ) + 1 ) << 32 | index;
+}
+
+static uint32_t blockpool_index( const blockpool_t *p, void *block )
+{
+	size_t offset = ( size_t )( ( uint8_t * )block - p->slab );
+	assert( offset % p->stride == 0 && offset / p->stride < p->nblocks );
+	return ( uint32_t )( offset / p->stride );
+}
+
+static void *blockpool_block( const blockpool_t *p, uint32_t i )
+{
+	return p->slab + i * p->stride;
+}
+
+static uint32_t blockpool_next( const blockpool_t *p, uint32_t i )
+{
+	return atomic_load_explicit( &p->next[ i ], memory_order_relaxed );
+}
+
+/*
+ * Push the chain of blocks from first to last, already linked through
+ * next, onto the shared stack. The release makes the blocks' contents
+ * and links visible to the thread that pops them.
+ */
+static void blockpool_push( blockpool_t *p, uint32_t first, uint32_t last )
+{
+	uint64_t old = atomic_load_explicit( &p->head, memory_order_relaxed );
+	do
+		atomic_store_explicit( &p->next[ last ], ( uint32_t )old, memory_order_relaxed );
+	while ( !atomic_compare_exchange_weak_explicit(
+		&p->head, &old, blockpool_pack( first, old ), memory_order_release, memory_order_relaxed ) );
+}
+
+/*
+ * Pop a chain of up to max blocks off the shared stack with a single
+ * compare-and-swap, and return its first block (BLOCKPOOL_NIL if the
+ * stack is empty) and its length in *count. The chain is walked before
+ * the swap; had any other thread pushed or popped in the meantime, the
+ * tag would have changed and the swap fails, so a walk over links that
+ * were being rewritten is thrown away and retried.
+ */
+static uint32_t blockpool_pop( blockpool_t *p, uint32_t max, uint32_t *count )
+{
+	uint64_t old = atomic_load_explicit( &p->head, memory_order_acquire );
+	uint32_t first, rest, n;
+	do
+	{
+		first = ( uint32_t )old;
+		if ( first == BLOCKPOOL_NIL )
+		{
+			*count = 0;
+			return BLOCKPOOL_NIL;
+		}
+		rest = blockpool_next( p, first );
+		for ( n = 1; n < max && rest < p->nblocks; ++n )
+			rest = blockpool_next( p, rest );
+	} while ( !atomic_compare_exchange_weak_explicit(
+		&p->head, &old, blockpool_pack( rest, old ), memory_order_acquire, memory_order_acquire ) );
+
+	assert( rest < p->nblocks || rest == BLOCKPOOL_NIL );
+	*count = n;
+	return first;
+}
+
+blockpool_t *blockpool_new( size_t block_size, size_t nblocks )
+{
+	assert( nblocks > 0 );
+	if ( nblocks >= BLOCKPOOL_NIL )
+		return NULL;
+
+	blockpool_t *p = aligned_alloc( alignof( blockpool_t ), sizeof( blockpool_t ) );
+	if ( p )
+	{
+		/* whole cache lines, so that blocks used by different threads never share one */
+		p->stride = ( block_size + RINGBUF_CACHELINE - 1 ) / RINGBUF_CACHELINE * RINGBUF_CACHELINE;
+		if ( p->stride == 0 )
+			p->stride = RINGBUF_CACHELINE;
+		p->block_size = block_size;
+		p->nblocks = ( uint32_t )nblocks;
+		p->slab = nblocks <= SIZE_MAX / p->stride ? aligned_alloc( RINGBUF_CACHELINE, nblocks * p->stride ) : NULL;
+		p->next = malloc( nblocks * sizeof( *p->next ) );
+		if ( !p->slab || !p->next )
+		{
+			free( p->slab );
+			free( p->next );
+			free( p );
+			return NULL;
+		}
+
+		/* touch the whole reserve now rather than on a real-time thread */
+		memset( p->slab, 0, nblocks * p->stride );
+		for ( uint32_t i = 0; i < p->nblocks; ++i )
+			atomic_init( &p->next[ i ], i + 1 < p->nblocks ? i + 1 : BLOCKPOOL_NIL );
+		atomic_init( &p->head, 0 );
+	}
+	return p;
+}
+
+void blockpool_free( blockpool_t *p )
+{
+	assert( p );
+	free( p->slab );
+	free( p->next );
+	free( p );
+}
+
+size_t blockpool_block_size( const blockpool_t *p )
+{
+	return p->block_size;
+}
+
+size_t blockpool_capacity( const blockpool_t *p )
+{
+	return p->nblocks;
+}
+
+void *blockpool_get( blockpool_t *p )
+{
+	uint32_t count;
+	uint32_t i = blockpool_pop( p, 1, &count );
+	return count ? blockpool_block( p, i ) : NULL;
+}
+
+void blockpool_put( blockpool_t *p, void *block )
+{
+	uint32_t i = blockpool_index( p, block );
+	blockpool_push( p, i, i );
+}
+
+void blockpool_cache_init( blockpool_cache_t *c, blockpool_t *p )
+{
+	c->pool = p;
+	c->head = BLOCKPOOL_NIL;
+	c->count = 0;
+}
+
+/* Hand the first n blocks of the cache back to the pool in one push */
+static void blockpool_cache_spill( blockpool_cache_t *c, uint32_t n )
+{
+	blockpool_t *p = c->pool;
+	uint32_t first = c->head, last = first;
+	assert( n > 0 && n <= c->count );
+	for ( uint32_t k = 1; k < n; ++k )
+		last = blockpool_next( p, last );
+	c->head = blockpool_next( p, last );
+	c->count -= n;
+	blockpool_push( p, first, last );
+}
+
+void *blockpool_cache_get( blockpool_cache_t *c )
+{
+	if ( c->count == 0 )
+	{
+		c->head = blockpool_pop( c->pool, BLOCKPOOL_CACHE_SIZE / 2, &c->count );
+		if ( c->count == 0 )
+			return NULL;
+	}
+	uint32_t i = c->head;
+	c->head = blockpool_next( c->pool, i );
+	--c->count;
+	return blockpool_block( c->pool, i );
+}
+
+void blockpool_cache_put( blockpool_cache_t *c, void *block )
+{
+	if ( c->count == BLOCKPOOL_CACHE_SIZE )
+		blockpool_cache_spill( c, BLOCKPOOL_CACHE_SIZE / 2 );
+	uint32_t i = blockpool_index( c->pool, block );
+	atomic_store_explicit( &c->pool->next[ i ], c->head, memory_order_relaxed );
+	c->head = i;
+	++c->count;
+}
+
+void blockpool_cache_flush( blockpool_cache_t *c )
+{
+	if ( c->count )
+		blockpool_cache_spill( c, c->count );
+}
@@ -0,0 +1,108 @@
+#ifndef INCLUDED_BLOCKPOOL_H
+#define INCLUDED_BLOCKPOOL_H
+
+/*
+ * blockpool.c - lock-free pool of fixed-size blocks.
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+/*
+ * A block pool hands out blocks of one size, e.g. one audio period,
+ * from a reserve that is allocated and touched once, up front, so that
+ * real-time threads can take and return blocks without ever calling
+ * malloc or taking a page fault. A block may be taken on one thread,
+ * passed to another (through a ringbuf_t of pointers, say) and
+ * returned there.
+ *
+ * The free blocks form a lock-free stack. Its head carries a tag that
+ * changes with every update, so a thread that was preempted in the
+ * middle of taking a block cannot be fooled by the same block having
+ * been taken and returned in the meantime (the ABA problem). The links
+ * are kept apart from the blocks, so all of a block is the caller's.
+ *
+ * Any number of threads may call blockpool_get and blockpool_put
+ * concurrently. A thread that takes and returns many blocks can keep a
+ * blockpool_cache_t of its own, which moves blocks to and from the
+ * shared stack a batch at a time, with one atomic operation per batch.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct blockpool_t blockpool_t;
+
+/* Most blocks a blockpool_cache_t holds */
+#define BLOCKPOOL_CACHE_SIZE 32
+
+/*
+ * A per-thread cache of free blocks, set up by blockpool_cache_init and
+ * then used by one thread only. Its fields are private to the
+ * blockpool_cache_* functions; it is only defined here so that it can
+ * live in the thread's own state without being allocated.
+ */
+typedef struct blockpool_cache_t
+{
+	blockpool_t *pool;
+	uint32_t head;
+	uint32_t count;
+} blockpool_cache_t;
+
+/*
+ * Create a pool of nblocks blocks of at least block_size bytes each.
+ * Every block is aligned to a cache line, and the whole reserve is
+ * allocated and zeroed here.
+ *
+ * Returns the new pool, or 0 if there's not enough memory or nblocks
+ * is too large.
+ */
+blockpool_t *blockpool_new( size_t block_size, size_t nblocks );
+
+/*
+ * Deallocate a pool and all of its blocks, whether they were returned
+ * or not. No other thread may still be using it.
+ */
+void blockpool_free( blockpool_t *p );
+
+size_t blockpool_block_size( const blockpool_t *p );
+
+size_t blockpool_capacity( const blockpool_t *p );
+
+/*
+ * Take a free block, or return 0 if the reserve is used up. The pool
+ * never grows.
+ */
+void *blockpool_get( blockpool_t *p );
+
+/*
+ * Return a block taken from p (on any thread, by any means) to the
+ * pool.
+ */
+void blockpool_put( blockpool_t *p, void *block );
+
+/*
+ * Per-thread caching. blockpool_cache_get takes a block from the
+ * cache, refilling it with half a cache's worth from the pool when it
+ * is empty, and blockpool_cache_put returns a block to the cache,
+ * handing half of it back to the pool when it is full. Blocks from a
+ * cache are ordinary blocks of the pool, and may be returned with
+ * blockpool_put or to any other thread's cache.
+ *
+ * blockpool_cache_flush returns every block in the cache to the pool,
+ * e.g. before the thread exits; otherwise they stay out of reach of
+ * the other threads.
+ */
+void blockpool_cache_init( blockpool_cache_t *c, blockpool_t *p );
+
+void *blockpool_cache_get( blockpool_cache_t *c );
+
+void blockpool_cache_put( blockpool_cache_t *c, void *block );
+
+void blockpool_cache_flush( blockpool_cache_t *c );
+
+// Include the implementation for a "header only" version of the library
+#ifdef BLOCKPOOL_IMPLEMENTATION
+#include "blockpool.c"
+#endif
+
+#endif /* INCLUDED_BLOCKPOOL_H */
@@ -0,0 +1,216 @@
+/*
+ * delayline.c - fractional delay line for float samples.
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+#include "delayline.h"
+#include "ringbuf_common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Guard samples before and after the history, for the cubic taps */
+#define DELAYLINE_GUARD_BEFORE 1
+#define DELAYLINE_GUARD_AFTER 2
+
+/*
+ * buf holds the last mask + 1 samples written, sample t at buf[ t &
+ * mask ], with buf[ -1 ] a copy of the last sample of the array and
+ * buf[ mask + 1 ] and buf[ mask + 2 ] copies of the first two, so
+ * that a run of reads ending at the end of the array may look one
+ * sample behind and two ahead of it without wrapping.
+ *
+ * head counts the samples written and block is the length of the
+ * last block, which starts at sample head - block.
+ */
+struct delayline_t
+{
+	float *mem;
+	float *buf;
+	size_t mask;
+	size_t max_delay;
+	size_t max_block;
+	size_t head;
+	size_t block;
+};
+
+delayline_t *delayline_new( size_t max_delay, size_t max_block )
+{
+	delayline_t *dl = malloc( sizeof( delayline_t ) );
+	if ( dl )
+	{
+		/* the oldest sample a block reads is max_block + max_delay + 1 behind the head */
+		size_t size = 0;
+		if ( max_delay < SIZE_MAX / 8 / sizeof( float ) && max_block < SIZE_MAX / 8 / sizeof( float ) )
+			size = ringbuf_pow2_ceil( max_delay + max_block + 2 );
+		if ( size == 0 )
+		{
+			free( dl );
+			errno = EINVAL;
+			return NULL;
+		}
+
+		dl->mem = malloc( ( DELAYLINE_GUARD_BEFORE + size + DELAYLINE_GUARD_AFTER ) * sizeof( float ) );
+		if ( !dl->mem )
+		{
+			free( dl );
+			return NULL;
+		}
+		dl->buf = dl->mem + DELAYLINE_GUARD_BEFORE;
+		dl->mask = size - 1;
+		dl->max_delay = max_delay;
+		dl->max_block = max_block;
+		delayline_reset( dl );
+	}
+	return dl;
+}
+
+void delayline_free( delayline_t *dl )
+{
+	assert( dl );
+	free( dl->mem );
+	free( dl );
+}
+
+void delayline_reset( delayline_t *dl )
+{
+	memset( dl->mem, 0, ( DELAYLINE_GUARD_BEFORE + dl->mask + 1 + DELAYLINE_GUARD_AFTER ) * sizeof( float ) );
+	dl->head = 0;
+	dl->block = 0;
+}
+
+size_t delayline_max_delay( const delayline_t *dl )
+{
+	return dl->max_delay;
+}
+
+void delayline_write( delayline_t *dl, const float *in, size_t count )
+{
+	assert( count <= dl->max_block );
+	size_t size = dl->mask + 1;
+	size_t i = dl->head & dl->mask;
+	size_t n = ringbuf_min( count, size - i );
+
+	memcpy( dl->buf + i, in, n * sizeof( float ) );
+	memcpy( dl->buf, in + n, ( count - n ) * sizeof( float ) );
+	dl->head += count;
+	dl->block = count;
+
+	dl->buf[ -1 ] = dl->buf[ dl->mask ];
+	dl->buf[ size ] = dl->buf[ 0 ];
+	dl->buf[ size + 1 ] = dl->buf[ 1 ];
+}
+
+/* Catmull-Rom interpolation at t in [0, 1] between p[ 0 ] and p[ 1 ] */
+static inline float delayline_cubic( const float *p, float t )
+{
+	float c1 = 0.5f * ( p[ 1 ] - p[ -1 ] );
+	float c2 = p[ -1 ] - 2.5f * p[ 0 ] + 2.0f * p[ 1 ] - 0.5f * p[ 2 ];
+	float c3 = 0.5f * ( p[ 2 ] - p[ -1 ] ) + 1.5f * ( p[ 0 ] - p[ 1 ] );
+	return ( ( c3 * t + c2 ) * t + c1 ) * t + p[ 0 ];
+}
+
+static inline float delayline_linear( const float *p, float t )
+{
+	return p[ 0 ] + t * ( p[ 1 ] - p[ 0 ] );
+}
+
+/* Clamp a delay, and fall back from cubic to linear where it must */
+static float delayline_clamp( const delayline_t *dl, float delay, int *interp )
+{
+	if ( !( delay > 0.0f ) )
+		delay = 0.0f;
+	if ( delay > ( float )dl->max_delay )
+		delay = ( float )dl->max_delay;
+	if ( delay < 1.0f )
+		*interp = DELAYLINE_LINEAR;
+	return delay;
+}
+
+/*
+ * Read (or, with accumulate, add) gain times a tap at a fixed delay
+ * into out. The tap's samples are read in at most two runs, split at
+ * the end of the array: sample n of a run interpolates between p[ n ]
+ * and p[ n + 1 ] with the same fraction t throughout, and an integer
+ * delay needs no interpolation at all.
+ */
+static void delayline_tap( const delayline_t *dl, float delay, int interp, float gain, float *restrict out,
+	size_t count, int accumulate )
+{
+	assert( count <= dl->block );
+	delay = delayline_clamp( dl, delay, &interp );
+	size_t k = ( size_t )delay;
+	float f = delay - ( float )k;
+
+	/* output n reads input start + n, or between that and the next */
+	size_t start = dl->head - dl->block - k - ( f > 0.0f );
+	float t = f > 0.0f ? 1.0f - f : 0.0f;
+
+	for ( size_t done = 0; done < count; )
+	{
+		size_t j = ( start + done ) & dl->mask;
+		size_t len = ringbuf_min( count - done, dl->mask + 1 - j );
+		const float *restrict p = dl->buf + j;
+		float *restrict o = out + done;
+
+		if ( f == 0.0f )
+		{
+			for ( size_t n = 0; n < len; ++n )
+				o[ n ] = ( accumulate ? o[ n ] : 0.0f ) + gain * p[ n ];
+		}
+		else if ( interp == DELAYLINE_CUBIC )
+		{
+			for ( size_t n = 0; n < len; ++n )
+				o[ n ] = ( accumulate ? o[ n ] : 0.0f ) + gain * delayline_cubic( p + n, t );
+		}
+		else
+		{
+			for ( size_t n = 0; n < len; ++n )
+				o[ n ] = ( accumulate ? o[ n ] : 0.0f ) + gain * delayline_linear( p + n, t );
+		}
+		done += len;
+	}
+}
+
+void delayline_read( const delayline_t *dl, float delay, int interp, float *out, size_t count )
+{
+	delayline_tap( dl, delay, interp, 1.0f, out, count, 0 );
+}
+
+void delayline_read_mod( const delayline_t *dl, const float *delay, int interp, float *out, size_t count )
+{
+	assert( count <= dl->block );
+	size_t base = dl->head - dl->block;
+
+	for ( size_t n = 0; n < count; ++n )
+	{
+		int mode = interp;
+		float d = delayline_clamp( dl, delay[ n ], &mode );
+		size_t k = ( size_t )d;
+		float f = d - ( float )k;
+		const float *p = dl->buf + ( ( base + n - k - ( f > 0.0f ) ) & dl->mask );
+
+		if ( f == 0.0f )
+			out[ n ] = p[ 0 ];
+		else if ( mode == DELAYLINE_CUBIC )
+			out[ n ] = delayline_cubic( p, 1.0f - f );
+		else
+			out[ n ] = delayline_linear( p, 1.0f - f );
+	}
+}
+
+void delayline_read_taps(
+	const delayline_t *dl, const delayline_tap_t *taps, size_t ntaps, int interp, float *out, size_t count )
+{
+	if ( ntaps == 0 )
+	{
+		memset( out, 0, count * sizeof( float ) );
+		return;
+	}
+	for ( size_t i = 0; i < ntaps; ++i )
+		delayline_tap( dl, taps[ i ].delay, interp, taps[ i ].gain, out, count, i > 0 );
+}
@@ -0,0 +1,106 @@
+#ifndef INCLUDED_DELAYLINE_H
+#define INCLUDED_DELAYLINE_H
+
+/*
+ * delayline.c - fractional delay line for float samples.
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+/*
+ * A delay line keeps the most recent history of one channel of float
+ * samples and reads it back at one or more delays behind the write
+ * head, for latency alignment, echoes, choruses and the like. Delays
+ * are in samples and may be fractional, in which case the output is
+ * interpolated linearly or with a 4-point cubic (Catmull-Rom) curve.
+ *
+ * Processing is done a block at a time: delayline_write appends a
+ * block of input, and the read functions then produce the matching
+ * block of output, sample n of which is the input delay samples before
+ * input sample n of that block. A delay of 0 passes the block through.
+ *
+ * The history is a power-of-two array, so every index is masked, never
+ * reduced with a modulo. It has guard copies of the samples on either
+ * side of the wrap point, so a tap at a fixed delay is read in (at
+ * most two) straight runs of plain array accesses that the compiler
+ * can vectorise, with no call per sample and no masking inside them.
+ *
+ * A delay line belongs to one thread; it has no producer and consumer
+ * split like a ringbuf_t.
+ */
+
+#include <stddef.h>
+
+/* Interpolation modes */
+#define DELAYLINE_LINEAR 0
+#define DELAYLINE_CUBIC 1
+
+/*
+ * One tap of delayline_read_taps: delay in samples and gain.
+ */
+typedef struct delayline_tap_t
+{
+	float delay;
+	float gain;
+} delayline_tap_t;
+
+typedef struct delayline_t delayline_t;
+
+/*
+ * Create a delay line for delays of up to max_delay samples, processed
+ * in blocks of up to max_block samples. The history starts out silent.
+ *
+ * Returns the new delay line, or 0 if there's not enough memory (or
+ * max_delay or max_block is too large, with errno set to EINVAL).
+ */
+delayline_t *delayline_new( size_t max_delay, size_t max_block );
+
+/*
+ * Deallocate a delay line.
+ */
+void delayline_free( delayline_t *dl );
+
+/*
+ * Silence the history.
+ */
+void delayline_reset( delayline_t *dl );
+
+size_t delayline_max_delay( const delayline_t *dl );
+
+/*
+ * Append count (at most max_block) samples from in to the history.
+ * They are the block that the following reads refer to.
+ */
+void delayline_write( delayline_t *dl, const float *in, size_t count );
+
+/*
+ * Read count samples (at most the length of the last block written)
+ * at a fixed delay into out, interpolating with interp
+ * (DELAYLINE_LINEAR or DELAYLINE_CUBIC) if the delay is fractional.
+ *
+ * The delay is clamped to between 0 and max_delay. A cubic tap needs
+ * one sample either side of the point it reads, so a fractional delay
+ * below 1 is interpolated linearly instead.
+ */
+void delayline_read( const delayline_t *dl, float delay, int interp, float *out, size_t count );
+
+/*
+ * As delayline_read, but with a delay per output sample, e.g. from an
+ * LFO for chorus or flanging, or a smoothed latency correction.
+ */
+void delayline_read_mod( const delayline_t *dl, const float *delay, int interp, float *out, size_t count );
+
+/*
+ * Read several taps at once: out[ n ] is the sum over the taps of
+ * gain times the input delay samples before input sample n, each tap
+ * read as by delayline_read. With no taps the output is silence.
+ */
+void delayline_read_taps(
+	const delayline_t *dl, const delayline_tap_t *taps, size_t ntaps, int interp, float *out, size_t count );
+
+// Include the implementation for a "header only" version of the library
+#ifdef DELAYLINE_IMPLEMENTATION
+#include "delayline.c"
+#endif
+
+#endif /* INCLUDED_DELAYLINE_H */
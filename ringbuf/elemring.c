@@ -0,0 +1,200 @@
+/*
+ * elemring.c - ring buffer (FIFO) of fixed-size elements.
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+#include "elemring.h"
+#include "ringbuf_common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * front and back count elements and only ever grow; masking them with
+ * capacity - 1 gives the element's slot in buf. As in ringbuf_t, the
+ * consumer and producer state live on separate cache lines, each with
+ * a cached copy of the other side's index.
+ */
+struct elemring_t
+{
+	uint8_t *buf;
+	size_t elem_size;
+	size_t mask;
+
+	/* Consumer state */
+	alignas( RINGBUF_CACHELINE ) atomic_size_t front;
+	size_t back_cache;
+
+	/* Producer state */
+	alignas( RINGBUF_CACHELINE ) atomic_size_t back;
+	size_t front_cache;
+};
+
+elemring_t *elemring_new( size_t nelems, size_t elem_size )
+{
+	assert( elem_size > 0 );
+	elemring_t *er = aligned_alloc( alignof( elemring_t ), sizeof( elemring_t ) );
+	if ( er )
+	{
+		size_t capacity = ringbuf_pow2_ceil( nelems );
+		if ( capacity == 0 || elem_size > SIZE_MAX / capacity )
+		{
+			free( er );
+			errno = EINVAL;
+			return NULL;
+		}
+
+		er->elem_size = elem_size;
+		er->mask = capacity - 1;
+		er->buf = malloc( capacity * elem_size );
+		if ( er->buf )
+			elemring_reset( er );
+		else
+		{
+			free( er );
+			return NULL;
+		}
+	}
+	return er;
+}
+
+void elemring_free( elemring_t *er )
+{
+	assert( er );
+	free( er->buf );
+	free( er );
+}
+
+void elemring_reset( elemring_t *er )
+{
+	atomic_store_explicit( &er->front, 0, memory_order_relaxed );
+	atomic_store_explicit( &er->back, 0, memory_order_relaxed );
+	er->back_cache = er->front_cache = 0;
+}
+
+size_t elemring_elem_size( const elemring_t *er )
+{
+	return er->elem_size;
+}
+
+size_t elemring_capacity( const elemring_t *er )
+{
+	return er->mask + 1;
+}
+
+size_t elemring_elems_free( const elemring_t *er )
+{
+	return elemring_capacity( er ) - elemring_elems_used( er );
+}
+
+size_t elemring_elems_used( const elemring_t *er )
+{
+	size_t front = atomic_load_explicit( &er->front, memory_order_acquire );
+	size_t back = atomic_load_explicit( &er->back, memory_order_acquire );
+	return back - front;
+}
+
+static uint8_t *elemring_at( const elemring_t *er, size_t i )
+{
+	return er->buf + ( i & er->mask ) * er->elem_size;
+}
+
+/* Producer side free space, refreshing the cached front if needed. */
+static size_t elemring_producer_free( elemring_t *er, size_t back, size_t count )
+{
+	size_t nfree = elemring_capacity( er ) - ( back - er->front_cache );
+	if ( nfree < count )
+	{
+		er->front_cache = atomic_load_explicit( &er->front, memory_order_acquire );
+		nfree = elemring_capacity( er ) - ( back - er->front_cache );
+	}
+	return nfree;
+}
+
+/* Consumer side used space, refreshing the cached back if needed. */
+static size_t elemring_consumer_used( elemring_t *er, size_t front, size_t count )
+{
+	size_t nused = er->back_cache - front;
+	if ( nused < count )
+	{
+		er->back_cache = atomic_load_explicit( &er->back, memory_order_acquire );
+		nused = er->back_cache - front;
+	}
+	return nused;
+}
+
+/*
+ * Split count elements starting at index i where the ring wraps.
+ */
+static void elemring_spans( const elemring_t *er, size_t i, size_t count, elemring_span_t span[ 2 ] )
+{
+	size_t n = ringbuf_min( elemring_capacity( er ) - ( i & er->mask ), count );
+	span[ 0 ].data = elemring_at( er, i );
+	span[ 0 ].count = n;
+	span[ 1 ].data = er->buf;
+	span[ 1 ].count = count - n;
+}
+
+size_t elemring_write_reserve( elemring_t *er, size_t count, elemring_span_t span[ 2 ] )
+{
+	size_t back = atomic_load_explicit( &er->back, memory_order_relaxed );
+	size_t nfree = elemring_producer_free( er, back, count );
+	count = ringbuf_min( count, nfree );
+	elemring_spans( er, back, count, span );
+	return count;
+}
+
+void elemring_write_commit( elemring_t *er, size_t count )
+{
+	size_t back = atomic_load_explicit( &er->back, memory_order_relaxed );
+	assert( count <= elemring_producer_free( er, back, count ) );
+	atomic_store_explicit( &er->back, back + count, memory_order_release );
+}
+
+size_t elemring_read_peek( elemring_t *er, size_t count, elemring_span_t span[ 2 ] )
+{
+	size_t front = atomic_load_explicit( &er->front, memory_order_relaxed );
+	size_t used = elemring_consumer_used( er, front, count );
+	count = ringbuf_min( count, used );
+	elemring_spans( er, front, count, span );
+	return count;
+}
+
+void elemring_read_consume( elemring_t *er, size_t count )
+{
+	size_t front = atomic_load_explicit( &er->front, memory_order_relaxed );
+	assert( count <= elemring_consumer_used( er, front, count ) );
+	atomic_store_explicit( &er->front, front + count, memory_order_release );
+}
+
+size_t elemring_push( elemring_t *er, const void *src, size_t count )
+{
+	elemring_span_t span[ 2 ];
+	count = elemring_write_reserve( er, count, span );
+
+	size_t nbytes = span[ 0 ].count * er->elem_size;
+	memcpy( span[ 0 ].data, src, nbytes );
+	memcpy( span[ 1 ].data, ( const uint8_t * )src + nbytes, span[ 1 ].count * er->elem_size );
+
+	elemring_write_commit( er, count );
+	return count;
+}
+
+size_t elemring_pop( elemring_t *er, void *dst, size_t count )
+{
+	elemring_span_t span[ 2 ];
+	count = elemring_read_peek( er, count, span );
+
+	size_t nbytes = span[ 0 ].count * er->elem_size;
+	memcpy( dst, span[ 0 ].data, nbytes );
+	memcpy( ( uint8_t * )dst + nbytes, span[ 1 ].data, span[ 1 ].count * er->elem_size );
+
+	elemring_read_consume( er, count );
+	return count;
+}
@@ -0,0 +1,111 @@
+#ifndef INCLUDED_ELEMRING_H
+#define INCLUDED_ELEMRING_H
+
+/*
+ * elemring.c - ring buffer (FIFO) of fixed-size elements.
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+/*
+ * A ring buffer whose unit is an element of a fixed size chosen at
+ * creation time, typically one audio frame (WaveFmtChunk.block_allign
+ * bytes: one sample for every channel). Every count taken or returned
+ * by these functions is in elements, and the buffer holds a whole
+ * number of elements, so an element is never split across the wrap
+ * point and a consumer can never take half a frame and swap the
+ * channels of everything after it.
+ *
+ * The capacity is a power of two, the indices are element counters
+ * that are masked into the buffer, and byte offsets are only ever
+ * computed by multiplying, never by dividing.
+ *
+ * Like an SPSC ringbuf_t, one producer thread (push, write_reserve,
+ * write_commit) and one consumer thread (pop, read_peek, read_consume)
+ * may use an element ring concurrently without locks. The ring never
+ * overflows: pushes are cut short when it fills up.
+ */
+
+#include <stddef.h>
+
+typedef struct elemring_t elemring_t;
+
+/*
+ * A run of whole elements that are contiguous in memory, as returned
+ * by elemring_write_reserve and elemring_read_peek.
+ */
+typedef struct elemring_span_t
+{
+	void *data;
+	size_t count;
+} elemring_span_t;
+
+/*
+ * Create a new element ring holding at least nelems elements of
+ * elem_size bytes each (the element count is rounded up to a power of
+ * two).
+ *
+ * Returns the new ring, or 0 if there's not enough memory (or the size
+ * asked for is too large, with errno set to EINVAL).
+ */
+elemring_t *elemring_new( size_t nelems, size_t elem_size );
+
+/*
+ * Deallocate an element ring.
+ */
+void elemring_free( elemring_t *er );
+
+/*
+ * Reset an element ring to its initial state (empty). Not thread safe.
+ */
+void elemring_reset( elemring_t *er );
+
+/*
+ * The size of one element in bytes, and the capacity of the ring in
+ * elements.
+ */
+size_t elemring_elem_size( const elemring_t *er );
+
+size_t elemring_capacity( const elemring_t *er );
+
+/*
+ * The number of free and used elements in the ring.
+ */
+size_t elemring_elems_free( const elemring_t *er );
+
+size_t elemring_elems_used( const elemring_t *er );
+
+/*
+ * Copy up to count elements from the contiguous array src into the
+ * ring. Returns the number of elements copied, which is less than
+ * count only if the ring filled up.
+ */
+size_t elemring_push( elemring_t *er, const void *src, size_t count );
+
+/*
+ * Copy up to count of the oldest elements out of the ring into the
+ * contiguous array dst. Returns the number of elements copied, which
+ * is less than count only if the ring ran empty.
+ */
+size_t elemring_pop( elemring_t *er, void *dst, size_t count );
+
+/*
+ * Zero-copy access, as for ringbuf_write_reserve/ringbuf_read_peek
+ * but in elements: the free or used region is described by up to two
+ * spans of whole elements, split where the ring wraps. Returns the
+ * number of elements the spans cover.
+ */
+size_t elemring_write_reserve( elemring_t *er, size_t count, elemring_span_t span[ 2 ] );
+
+void elemring_write_commit( elemring_t *er, size_t count );
+
+size_t elemring_read_peek( elemring_t *er, size_t count, elemring_span_t span[ 2 ] );
+
+void elemring_read_consume( elemring_t *er, size_t count );
+
+// Include the implementation for a "header only" version of the library
+#ifdef ELEMRING_IMPLEMENTATION
+#include "elemring.c"
+#endif
+
+#endif /* INCLUDED_ELEMRING_H */
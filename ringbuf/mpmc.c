@@ -0,0 +1,200 @@
+/*
+ * mpmc.c - bounded multi-producer/multi-consumer queue.
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+#include "mpmc.h"
+#include "ringbuf_common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Each slot starts with its sequence number, followed by the item.
+ * A slot at position pos (an ever increasing counter, masked into the
+ * slot array) is free for the producer of pos when seq == pos, and
+ * holds the item for the consumer of pos when seq == pos + 1. Popping
+ * the item sets seq to pos + capacity, which is the position that
+ * refers to the same slot on the next lap around the queue.
+ *
+ * The positions at which the next item is pushed and popped are
+ * shared between all producers and all consumers respectively, and
+ * are kept on separate cache lines.
+ */
+struct mpmc_queue_t
+{
+	uint8_t *slots;
+	size_t stride;
+	size_t item_size;
+	size_t mask;
+
+	alignas( RINGBUF_CACHELINE ) atomic_size_t enqueue_pos;
+	alignas( RINGBUF_CACHELINE ) atomic_size_t dequeue_pos;
+};
+
+static atomic_size_t *mpmc_queue_seq( const mpmc_queue_t *q, size_t pos )
+{
+	return ( atomic_size_t * )( q->slots + ( pos & q->mask ) * q->stride );
+}
+
+static uint8_t *mpmc_queue_item( const mpmc_queue_t *q, size_t pos )
+{
+	return q->slots + ( pos & q->mask ) * q->stride + sizeof( atomic_size_t );
+}
+
+mpmc_queue_t *mpmc_queue_new( size_t item_size, size_t nslots )
+{
+	mpmc_queue_t *q = aligned_alloc( alignof( mpmc_queue_t ), sizeof( mpmc_queue_t ) );
+	if ( q )
+	{
+		size_t capacity = ringbuf_pow2_ceil( nslots < 2 ? 2 : nslots );
+
+		/* keep every sequence number aligned */
+		q->stride = sizeof( atomic_size_t ) + item_size;
+		q->stride = ( q->stride + alignof( atomic_size_t ) - 1 ) / alignof( atomic_size_t ) * alignof( atomic_size_t );
+		if ( capacity == 0 || item_size > SIZE_MAX / 2 || q->stride > SIZE_MAX / capacity )
+		{
+			free( q );
+			errno = EINVAL;
+			return NULL;
+		}
+		q->item_size = item_size;
+		q->mask = capacity - 1;
+		q->slots = malloc( capacity * q->stride );
+		if ( !q->slots )
+		{
+			free( q );
+			return NULL;
+		}
+
+		for ( size_t i = 0; i < capacity; ++i )
+			atomic_init( mpmc_queue_seq( q, i ), i );
+		atomic_init( &q->enqueue_pos, 0 );
+		atomic_init( &q->dequeue_pos, 0 );
+	}
+	return q;
+}
+
+void mpmc_queue_free( mpmc_queue_t *q )
+{
+	assert( q );
+	free( q->slots );
+	free( q );
+}
+
+size_t mpmc_queue_capacity( const mpmc_queue_t *q )
+{
+	return q->mask + 1;
+}
+
+size_t mpmc_queue_item_size( const mpmc_queue_t *q )
+{
+	return q->item_size;
+}
+
+size_t mpmc_queue_size( const mpmc_queue_t *q )
+{
+	size_t dequeue_pos = atomic_load_explicit( &q->dequeue_pos, memory_order_relaxed );
+	size_t enqueue_pos = atomic_load_explicit( &q->enqueue_pos, memory_order_relaxed );
+	size_t size = enqueue_pos - dequeue_pos;
+
+	/* the two loads are not a snapshot; keep the estimate in range */
+	if ( size > q->mask + 1 )
+		size = dequeue_pos > enqueue_pos ? 0 : q->mask + 1;
+	return size;
+}
+
+/*
+ * Claim up to count consecutive positions from *shared. A position is
+ * claimable when its slot's sequence number equals the position plus
+ * lag (0 for producers, 1 for consumers). Returns the number of
+ * positions claimed and stores the first one in *first.
+ *
+ * Only the prefix of slots that are ready can be claimed: the slot
+ * after a ready one may still be held by a slow thread from the
+ * previous lap. Slots seen ready cannot be taken by anyone else before
+ * the compare and swap, because every other claimant has to move the
+ * same shared index past them first.
+ */
+static size_t mpmc_queue_claim( mpmc_queue_t *q, atomic_size_t *shared, size_t lag, size_t count, size_t *first )
+{
+	size_t pos = atomic_load_explicit( shared, memory_order_relaxed );
+	if ( count == 0 )
+		return 0;
+
+	for ( ;; )
+	{
+		size_t n = 0;
+		intptr_t dif = 0;
+		while ( n < count )
+		{
+			size_t seq = atomic_load_explicit( mpmc_queue_seq( q, pos + n ), memory_order_acquire );
+			dif = ( intptr_t )( seq - ( pos + n + lag ) );
+			if ( dif != 0 )
+				break;
+			++n;
+		}
+
+		if ( n == 0 )
+		{
+			/* the slot is from the previous lap: full (or empty) */
+			if ( dif < 0 )
+				return 0;
+
+			/* someone else claimed pos already */
+			pos = atomic_load_explicit( shared, memory_order_relaxed );
+			continue;
+		}
+
+		if ( atomic_compare_exchange_weak_explicit(
+				 shared, &pos, pos + n, memory_order_relaxed, memory_order_relaxed ) )
+		{
+			*first = pos;
+			return n;
+		}
+	}
+}
+
+int mpmc_queue_push( mpmc_queue_t *q, const void *item )
+{
+	return mpmc_queue_push_batch( q, item, 1 ) == 1;
+}
+
+int mpmc_queue_pop( mpmc_queue_t *q, void *item )
+{
+	return mpmc_queue_pop_batch( q, item, 1 ) == 1;
+}
+
+size_t mpmc_queue_push_batch( mpmc_queue_t *q, const void *items, size_t count )
+{
+	const uint8_t *u8src = items;
+	size_t pos;
+	size_t n = mpmc_queue_claim( q, &q->enqueue_pos, 0, ringbuf_min( count, q->mask + 1 ), &pos );
+
+	for ( size_t i = 0; i < n; ++i )
+	{
+		memcpy( mpmc_queue_item( q, pos + i ), u8src + i * q->item_size, q->item_size );
+		atomic_store_explicit( mpmc_queue_seq( q, pos + i ), pos + i + 1, memory_order_release );
+	}
+	return n;
+}
+
+size_t mpmc_queue_pop_batch( mpmc_queue_t *q, void *items, size_t count )
+{
+	uint8_t *u8dst = items;
+	size_t pos;
+	size_t n = mpmc_queue_claim( q, &q->dequeue_pos, 1, ringbuf_min( count, q->mask + 1 ), &pos );
+
+	for ( size_t i = 0; i < n; ++i )
+	{
+		memcpy( u8dst + i * q->item_size, mpmc_queue_item( q, pos + i ), q->item_size );
+		atomic_store_explicit( mpmc_queue_seq( q, pos + i ), pos + i + q->mask + 1, memory_order_release );
+	}
+	return n;
+}
@@ -0,0 +1,90 @@
+#ifndef INCLUDED_MPMC_H
+#define INCLUDED_MPMC_H
+
+/*
+ * mpmc.c - bounded multi-producer/multi-consumer queue.
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+/*
+ * A bounded FIFO of fixed-size slots that any number of threads may
+ * push to and pop from at the same time, without locks.
+ *
+ * This is Dmitry Vyukov's bounded MPMC queue: every slot carries a
+ * sequence number that says whether it is ready to be written (for
+ * the lap of the queue a producer is on) or ready to be read. A
+ * producer or consumer claims a position with a single compare and
+ * swap on the shared index and then copies its item without holding
+ * anything, so a thread that is descheduled mid-copy only delays the
+ * consumer of that one slot.
+ *
+ * Where ringbuf_t moves a stream of bytes between one producer and one
+ * consumer, mpmc_queue_t moves whole items (e.g. descriptors of
+ * decoded audio blocks) between any number of each.
+ */
+
+#include <stddef.h>
+
+typedef struct mpmc_queue_t mpmc_queue_t;
+
+/*
+ * Create a new queue holding up to nslots items of item_size bytes
+ * each. nslots is rounded up to a power of two (and at least 2).
+ *
+ * Returns the new queue, or 0 if there's not enough memory (or nslots
+ * or item_size is too large, with errno set to EINVAL).
+ */
+mpmc_queue_t *mpmc_queue_new( size_t item_size, size_t nslots );
+
+/*
+ * Deallocate a queue. No other thread may be using it.
+ */
+void mpmc_queue_free( mpmc_queue_t *q );
+
+/*
+ * The number of slots in the queue, and the size of one item in bytes.
+ */
+size_t mpmc_queue_capacity( const mpmc_queue_t *q );
+
+size_t mpmc_queue_item_size( const mpmc_queue_t *q );
+
+/*
+ * An estimate of the number of items in the queue. The value is exact
+ * only when no other thread is pushing or popping.
+ */
+size_t mpmc_queue_size( const mpmc_queue_t *q );
+
+/*
+ * Copy one item of item_size bytes into the queue. Returns 1 on
+ * success, or 0 if the queue is full, in which case nothing is copied.
+ */
+int mpmc_queue_push( mpmc_queue_t *q, const void *item );
+
+/*
+ * Copy the oldest item out of the queue into item. Returns 1 on
+ * success, or 0 if the queue is empty.
+ */
+int mpmc_queue_pop( mpmc_queue_t *q, void *item );
+
+/*
+ * Push up to count items, stored contiguously at items, claiming all
+ * of their slots with a single atomic operation. Items are pushed in
+ * order and stay adjacent in the queue. Returns the number of items
+ * pushed, which is less than count only if the queue filled up.
+ */
+size_t mpmc_queue_push_batch( mpmc_queue_t *q, const void *items, size_t count );
+
+/*
+ * Pop up to count items into the contiguous array items, claiming all
+ * of their slots with a single atomic operation. Returns the number of
+ * items popped, which is less than count only if the queue ran empty.
+ */
+size_t mpmc_queue_pop_batch( mpmc_queue_t *q, void *items, size_t count );
+
+// Include the implementation for a "header only" version of the library
+#ifdef MPMC_IMPLEMENTATION
+#include "mpmc.c"
+#endif
+
+#endif /* INCLUDED_MPMC_H */
@@ -0,0 +1,309 @@
+#ifndef INCLUDED_RING_HPP
+#define INCLUDED_RING_HPP
+
+/*
+ * ring.hpp - typed single-producer/single-consumer ring buffer (C++20).
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+/*
+ * utils::ring<T, N> is the C++ counterpart of an SPSC power-of-two
+ * ringbuf_t: a FIFO of N elements of type T (N a power of two, known
+ * at compile time), with front and back counters that only ever grow
+ * and are masked into the buffer, each on its own cache line next to
+ * a cached copy of the other side's counter.
+ *
+ * One producer thread (try_push, emplace, push, push_move,
+ * write_reserve, write_commit) and one consumer thread (try_pop, pop,
+ * peek, consume) may use a ring concurrently without locks. The ring
+ * never overflows: a push that does not fit is refused or cut short.
+ *
+ * Elements live in raw storage and are constructed when pushed and
+ * destroyed when popped, so T need not be default constructible. A
+ * trivially copyable T is moved in and out with memcpy, at most two
+ * per bulk operation; any other T is copy or move constructed and
+ * move assigned element by element, never copied as bytes.
+ */
+
+#include "ringbuf_common.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+namespace utils
+{
+
+template <typename T, std::size_t N> class ring
+{
+	static_assert( N > 0 && ( N & ( N - 1 ) ) == 0, "ring capacity must be a power of two" );
+
+	static constexpr std::size_t mask = N - 1;
+	static constexpr bool trivial = std::is_trivially_copyable_v<T>;
+
+public:
+	ring() = default;
+	ring( const ring & ) = delete;
+	ring &operator=( const ring & ) = delete;
+
+	~ring()
+	{
+		if constexpr ( !std::is_trivially_destructible_v<T> )
+		{
+			std::size_t front = front_.load( std::memory_order_relaxed );
+			std::size_t back = back_.load( std::memory_order_relaxed );
+			for ( ; front != back; ++front )
+				std::destroy_at( at( front ) );
+		}
+	}
+
+	static constexpr std::size_t capacity() noexcept
+	{
+		return N;
+	}
+
+	/*
+	 * The number of used elements. Exact only when called from the
+	 * producer or consumer while the other side is idle.
+	 */
+	std::size_t size() const noexcept
+	{
+		std::size_t front = front_.load( std::memory_order_acquire );
+		return back_.load( std::memory_order_acquire ) - front;
+	}
+
+	bool empty() const noexcept
+	{
+		return size() == 0;
+	}
+
+	bool full() const noexcept
+	{
+		return size() == N;
+	}
+
+	/*
+	 * Construct one element at the back from args. Returns false,
+	 * constructing nothing, if the ring is full.
+	 */
+	template <typename... Args> bool emplace( Args &&...args )
+	{
+		std::size_t back = back_.load( std::memory_order_relaxed );
+		if ( producer_free( back, 1 ) == 0 )
+			return false;
+		std::construct_at( at( back ), std::forward<Args>( args )... );
+		back_.store( back + 1, std::memory_order_release );
+		return true;
+	}
+
+	bool try_push( const T &item )
+	{
+		return emplace( item );
+	}
+
+	bool try_push( T &&item )
+	{
+		return emplace( std::move( item ) );
+	}
+
+	/*
+	 * Move the oldest element into out and destroy it in the ring.
+	 * Returns false, leaving out alone, if the ring is empty.
+	 */
+	bool try_pop( T &out )
+	{
+		std::size_t front = front_.load( std::memory_order_relaxed );
+		if ( consumer_used( front, 1 ) == 0 )
+			return false;
+		out = std::move( *at( front ) );
+		std::destroy_at( at( front ) );
+		front_.store( front + 1, std::memory_order_release );
+		return true;
+	}
+
+	/*
+	 * Copy (push) or move (push_move) up to items.size() elements into
+	 * the ring, in order. Returns the number taken, which is less than
+	 * items.size() only if the ring filled up; push_move leaves the
+	 * elements it did not take untouched.
+	 */
+	std::size_t push( std::span<const T> items )
+	{
+		return push_n( items.data(), items.size(), []( const T &item ) -> const T & { return item; } );
+	}
+
+	std::size_t push_move( std::span<T> items )
+	{
+		return push_n( items.data(), items.size(), []( T &item ) -> T && { return std::move( item ); } );
+	}
+
+	/*
+	 * Move up to out.size() of the oldest elements into out, in order.
+	 * Returns the number popped, which is less than out.size() only if
+	 * the ring ran empty.
+	 */
+	std::size_t pop( std::span<T> out )
+	{
+		std::size_t front = front_.load( std::memory_order_relaxed );
+		std::size_t count = std::min( out.size(), consumer_used( front, out.size() ) );
+		std::size_t i = front & mask;
+		std::size_t n = std::min( count, N - i );
+
+		publish done{ front_, front };
+
+		if constexpr ( trivial )
+		{
+			std::memcpy( out.data(), at( front ), n * sizeof( T ) );
+			std::memcpy( out.data() + n, at( 0 ), ( count - n ) * sizeof( T ) );
+			done.count = count;
+		}
+		else
+		{
+			for ( ; done.count < count; ++done.count )
+			{
+				out[ done.count ] = std::move( *at( front + done.count ) );
+				std::destroy_at( at( front + done.count ) );
+			}
+		}
+		return count;
+	}
+
+	/*
+	 * Zero-copy access to the oldest count elements (or all of them,
+	 * if fewer are used), as at most two contiguous spans split where
+	 * the ring wraps. consume then destroys and releases the given
+	 * number of elements from the front. Consumer side.
+	 */
+	std::array<std::span<T>, 2> peek( std::size_t count = N )
+	{
+		std::size_t front = front_.load( std::memory_order_relaxed );
+		return spans( front, std::min( count, consumer_used( front, count ) ) );
+	}
+
+	void consume( std::size_t count )
+	{
+		std::size_t front = front_.load( std::memory_order_relaxed );
+		if constexpr ( !std::is_trivially_destructible_v<T> )
+		{
+			for ( std::size_t k = 0; k < count; ++k )
+				std::destroy_at( at( front + k ) );
+		}
+		front_.store( front + count, std::memory_order_release );
+	}
+
+	/*
+	 * Zero-copy access to up to count free elements at the back, for a
+	 * trivially copyable T only: the caller writes into the spans and
+	 * then commits the number of elements written, which makes them
+	 * visible to the consumer. Producer side.
+	 */
+	std::array<std::span<T>, 2> write_reserve( std::size_t count = N )
+		requires std::is_trivially_copyable_v<T>
+	{
+		std::size_t back = back_.load( std::memory_order_relaxed );
+		return spans( back, std::min( count, producer_free( back, count ) ) );
+	}
+
+	void write_commit( std::size_t count )
+		requires std::is_trivially_copyable_v<T>
+	{
+		back_.store( back_.load( std::memory_order_relaxed ) + count, std::memory_order_release );
+	}
+
+private:
+	/*
+	 * Publishes index + count on scope exit, so that if a constructor
+	 * or assignment throws half way through a bulk push or pop, the
+	 * elements already moved stay accounted for.
+	 */
+	struct publish
+	{
+		std::atomic<std::size_t> &index;
+		std::size_t base;
+		std::size_t count = 0;
+
+		~publish()
+		{
+			index.store( base + count, std::memory_order_release );
+		}
+	};
+
+	T *at( std::size_t i ) noexcept
+	{
+		return reinterpret_cast<T *>( storage_ ) + ( i & mask );
+	}
+
+	/* Producer side free space, refreshing the cached front if needed. */
+	std::size_t producer_free( std::size_t back, std::size_t count ) noexcept
+	{
+		std::size_t nfree = N - ( back - front_cache_ );
+		if ( nfree < count )
+		{
+			front_cache_ = front_.load( std::memory_order_acquire );
+			nfree = N - ( back - front_cache_ );
+		}
+		return nfree;
+	}
+
+	/* Consumer side used space, refreshing the cached back if needed. */
+	std::size_t consumer_used( std::size_t front, std::size_t count ) noexcept
+	{
+		std::size_t nused = back_cache_ - front;
+		if ( nused < count )
+		{
+			back_cache_ = back_.load( std::memory_order_acquire );
+			nused = back_cache_ - front;
+		}
+		return nused;
+	}
+
+	std::array<std::span<T>, 2> spans( std::size_t i, std::size_t count ) noexcept
+	{
+		std::size_t n = std::min( count, N - ( i & mask ) );
+		return { std::span<T>( at( i ), n ), std::span<T>( at( 0 ), count - n ) };
+	}
+
+	template <typename U, typename Get> std::size_t push_n( U *items, std::size_t size, Get get )
+	{
+		std::size_t back = back_.load( std::memory_order_relaxed );
+		std::size_t count = std::min( size, producer_free( back, size ) );
+		std::size_t i = back & mask;
+		std::size_t n = std::min( count, N - i );
+
+		publish done{ back_, back };
+
+		if constexpr ( trivial )
+		{
+			std::memcpy( static_cast<void *>( at( back ) ), items, n * sizeof( T ) );
+			std::memcpy( static_cast<void *>( at( 0 ) ), items + n, ( count - n ) * sizeof( T ) );
+			done.count = count;
+		}
+		else
+		{
+			for ( ; done.count < count; ++done.count )
+				std::construct_at( at( back + done.count ), get( items[ done.count ] ) );
+		}
+		return count;
+	}
+
+	alignas( T ) std::byte storage_[ N * sizeof( T ) ];
+
+	/* Consumer state */
+	alignas( RINGBUF_CACHELINE ) std::atomic<std::size_t> front_{ 0 };
+	std::size_t back_cache_ = 0;
+
+	/* Producer state */
+	alignas( RINGBUF_CACHELINE ) std::atomic<std::size_t> back_{ 0 };
+	std::size_t front_cache_ = 0;
+};
+
+} // namespace utils
+
+#endif /* INCLUDED_RING_HPP */
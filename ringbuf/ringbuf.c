@@ -10,12 +10,38 @@
  * <https://mit-license.org/>.
  */
 
+/* memfd_create, MAP_HUGETLB and friends */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "ringbuf.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#define RINGBUF_POSIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <linux/membarrier.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
 
 /*
  * The code is written for clarity, not cleverness or performance, and
@@ -26,243 +52,1807 @@
  */
 
 /*
- * The struct is setup such that back always points to a position just
- * after where data is stored. Additionally, the buffer size holds one
- * extra byte as a sentinel value so that the empty and full conditions can be
- * distinguished.
+ * Statistics. Every counter has exactly one writer, either the
+ * producer or the consumer, so it is updated with a relaxed load and
+ * store rather than a locked read-modify-write, and the two sides'
+ * counters are kept on separate cache lines. A monitoring thread reads
+ * them with relaxed loads.
  */
-struct ringbuf_t
+struct ringbuf_stats_state
 {
-	uint8_t *buf;
-	uint8_t *front, *back;
-	size_t capacity;
+	double bin_scale;
+
+	/* Producer counters */
+	alignas( RINGBUF_CACHELINE ) atomic_uint_least64_t bytes_in;
+	atomic_uint_least64_t overflows;
+	atomic_uint_least64_t bytes_lost;
+	atomic_uint_least64_t push_refusals;
+	atomic_size_t high_water;
+
+	/* Consumer counters */
+	alignas( RINGBUF_CACHELINE ) atomic_uint_least64_t bytes_out;
+	atomic_uint_least64_t pop_refusals;
+	atomic_size_t low_water;
+	atomic_uint_least64_t histogram[ RINGBUF_STATS_BINS ];
 };
 
-ringbuf_t *ringbuf_new( size_t capacity )
+/* Internal flag: buf was mmap'ed by ringbuf_alloc_buf, not allocated */
+#define RINGBUF_MAPPED 0x10000
+
+/* Internal flags: read_event and write_event are attached */
+#define RINGBUF_READ_EVENT 0x40000
+#define RINGBUF_WRITE_EVENT 0x80000
+
+/* Internal flag: ctl and buf are in a mapping shared between processes */
+#define RINGBUF_SHARED 0x100000
+
+/* The flags a caller may pass when creating a ring buffer */
+#define RINGBUF_PUBLIC_FLAGS                                                                                           \
+	( RINGBUF_SPSC | RINGBUF_MIRRORED | RINGBUF_POW2 | RINGBUF_GROW | RINGBUF_ALIGN_CACHELINE | RINGBUF_ALIGN_PAGE     \
+		| RINGBUF_HUGEPAGES | RINGBUF_PREFAULT | RINGBUF_MLOCK )
+
+/*
+ * The start of a shared memory ring buffer's mapping. The buffer
+ * follows at offset header_size, a whole number of pages, and is
+ * capacity bytes long. ringbuf_new_shm stores magic last, so a process
+ * attaching never trusts a half-written header.
+ */
+struct ringbuf_shm_header
 {
-	ringbuf_t *rb = malloc( sizeof( ringbuf_t ) );
-	if ( rb )
-	{
+	atomic_uint magic;
+	uint32_t version;
+	uint64_t header_size;
+	uint64_t capacity;
+	uint32_t flags;
+	struct ringbuf_ctl ctl;
+};
 
-		/* One byte is used for detecting the full condition. */
-		rb->capacity = capacity + 1;
-		rb->buf = malloc( rb->capacity );
-		if ( rb->buf )
-			ringbuf_reset( rb );
-		else
+#define RINGBUF_SHM_MAGIC 0x52425546 /* "RBUF" */
+#define RINGBUF_SHM_VERSION 1
+
+#ifndef RINGBUF_HUGEPAGE_SIZE
+#define RINGBUF_HUGEPAGE_SIZE ( ( size_t )2 << 20 )
+#endif
+
+static size_t ringbuf_round_up( size_t n, size_t multiple )
+{
+	return ( n + multiple - 1 ) / multiple * multiple;
+}
+
+static void *ringbuf_default_alloc( size_t size, size_t align, void *ctx )
+{
+	( void )ctx;
+	if ( align <= alignof( max_align_t ) )
+		return malloc( size );
+	return aligned_alloc( align, ringbuf_round_up( size, align ) );
+}
+
+static void ringbuf_default_free( void *ptr, size_t size, void *ctx )
+{
+	( void )size;
+	( void )ctx;
+	free( ptr );
+}
+
+static const ringbuf_allocator_t ringbuf_default_allocator = { ringbuf_default_alloc, ringbuf_default_free, NULL };
+
+#ifdef __linux__
+/*
+ * Map size bytes of a memfd twice, back to back, so that
+ * buf[i] and buf[i + size] are the same byte. size must be a multiple
+ * of the page size (of the huge page size, if huge is set).
+ */
+static uint8_t *ringbuf_map_mirrored( size_t size, int huge )
+{
+	uint8_t *base = NULL;
+	int fd = memfd_create( "ringbuf", MFD_CLOEXEC | ( huge ? MFD_HUGETLB : 0 ) );
+	if ( fd < 0 )
+		return NULL;
+
+	if ( ftruncate( fd, size ) == 0 )
+	{
+		/* reserve the address range for both halves first */
+		base = mmap( NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+		if ( base == MAP_FAILED )
+			base = NULL;
+		else if ( mmap( base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0 ) == MAP_FAILED
+			|| mmap( base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0 ) == MAP_FAILED )
 		{
-			free( rb );
-			return NULL;
+			munmap( base, 2 * size );
+			base = NULL;
 		}
 	}
-	return rb;
+
+	/* the mappings keep the memory alive */
+	close( fd );
+	return base;
 }
 
-size_t ringbuf_buffer_capacity( const ringbuf_t *rb )
+/*
+ * Map size bytes of anonymous memory backed by huge pages, falling
+ * back to transparent huge pages when none are reserved.
+ */
+static uint8_t *ringbuf_map_huge( size_t size )
 {
-	return rb->capacity - 1;
+	uint8_t *buf = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+	if ( buf != MAP_FAILED )
+		return buf;
+
+	buf = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if ( buf == MAP_FAILED )
+		return NULL;
+	madvise( buf, size, MADV_HUGEPAGE );
+	return buf;
+}
+#endif
+
+/*
+ * Allocate rb->buf according to the flags, possibly growing
+ * rb->capacity to fill whole pages, and record how much was allocated
+ * in rb->map_size.
+ */
+static uint8_t *ringbuf_alloc_buf( ringbuf_t *rb )
+{
+	int huge = rb->flags & RINGBUF_HUGEPAGES;
+	size_t align = 0;
+
+	if ( rb->flags & RINGBUF_MIRRORED )
+	{
+#ifdef __linux__
+		uint8_t *buf = NULL;
+		size_t size;
+		if ( huge )
+		{
+			size = ringbuf_round_up( rb->capacity, RINGBUF_HUGEPAGE_SIZE );
+			buf = ringbuf_map_mirrored( size, 1 );
+		}
+		if ( !buf )
+		{
+			size = ringbuf_round_up( rb->capacity, ( size_t )sysconf( _SC_PAGESIZE ) );
+			buf = ringbuf_map_mirrored( size, 0 );
+		}
+		rb->capacity = size;
+		rb->map_size = 2 * size;
+		rb->flags |= RINGBUF_MAPPED;
+		return buf;
+#else
+		return NULL;
+#endif
+	}
+
+#ifdef __linux__
+	if ( huge && rb->alloc.alloc == ringbuf_default_alloc )
+	{
+		rb->map_size = ringbuf_round_up( rb->capacity, RINGBUF_HUGEPAGE_SIZE );
+		rb->flags |= RINGBUF_MAPPED;
+		return ringbuf_map_huge( rb->map_size );
+	}
+#endif
+
+	if ( huge )
+		align = RINGBUF_HUGEPAGE_SIZE;
+	else if ( rb->flags & RINGBUF_ALIGN_PAGE )
+		align = ( size_t )sysconf( _SC_PAGESIZE );
+	else if ( rb->flags & RINGBUF_ALIGN_CACHELINE )
+		align = RINGBUF_CACHELINE;
+	rb->map_size = rb->capacity;
+	return rb->alloc.alloc( rb->capacity, align, rb->alloc.ctx );
 }
 
-void ringbuf_reset( ringbuf_t *rb )
+/* Release a buffer allocated by ringbuf_alloc_buf with the given flags */
+static void ringbuf_free_mem( ringbuf_t *rb, uint8_t *buf, size_t map_size, int flags )
 {
-	rb->front = rb->back = rb->buf;
+#ifdef RINGBUF_POSIX
+	if ( flags & RINGBUF_MLOCK )
+		munlock( buf, map_size );
+	if ( flags & RINGBUF_MAPPED )
+	{
+		munmap( buf, map_size );
+		return;
+	}
+#endif
+	rb->alloc.free( buf, map_size, rb->alloc.ctx );
 }
 
-void ringbuf_free( ringbuf_t *rb )
+static void ringbuf_free_buf( ringbuf_t *rb )
 {
-	assert( rb );
-	free( rb->buf );
-	free( rb );
-	rb = NULL;
+#ifdef RINGBUF_POSIX
+	if ( rb->flags & RINGBUF_SHARED )
+	{
+		/* the mapping starts with the header that ctl lives in */
+		munmap( ( uint8_t * )rb->ctl - offsetof( struct ringbuf_shm_header, ctl ), rb->map_size );
+		return;
+	}
+#endif
+	ringbuf_free_mem( rb, rb->buf, rb->map_size, rb->flags );
 }
 
 /*
- * Return a pointer to one-past-the-end of the ring buffer's
- * contiguous buffer. You shouldn't normally need to use this function
- * unless you're writing a new ringbuf_* function.
+ * Give rb a new, empty, internal buffer with a usable capacity of at
+ * least capacity bytes, set up according to its flags. Returns 0, or
+ * -1 with errno set (and no buffer) on failure.
  */
-static const uint8_t *ringbuf_end( const ringbuf_t *rb )
+static int ringbuf_setup_buf( ringbuf_t *rb, size_t capacity )
 {
-	return rb->buf + rb->capacity;
+	/* leave room for rounding up to a power of two and mirroring */
+	if ( capacity > SIZE_MAX / 4 )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* One byte is used for detecting the full condition. */
+	rb->capacity = capacity + 1;
+	rb->mask = SIZE_MAX;
+	if ( rb->flags & RINGBUF_POW2 )
+	{
+		/* ... except in a power-of-two buffer */
+		rb->capacity = ringbuf_pow2_ceil( capacity );
+	}
+	rb->buf = ringbuf_alloc_buf( rb );
+	if ( rb->flags & RINGBUF_POW2 )
+		rb->mask = rb->capacity - 1;
+	if ( !rb->buf )
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* fault every page in now rather than in the first callback */
+	if ( rb->flags & ( RINGBUF_PREFAULT | RINGBUF_MLOCK ) )
+		memset( rb->buf, 0, rb->map_size );
+#ifdef RINGBUF_POSIX
+	if ( ( rb->flags & RINGBUF_MLOCK ) && mlock( rb->buf, rb->map_size ) != 0 )
+	{
+		int err = errno;
+		ringbuf_free_mem( rb, rb->buf, rb->map_size, rb->flags & ~RINGBUF_MLOCK );
+		errno = err;
+		return -1;
+	}
+#endif
+	return 0;
 }
 
-size_t ringbuf_bytes_free( const ringbuf_t *rb )
+/* Point rb at ctl and start it empty, with nobody waiting */
+static void ringbuf_init_ctl( ringbuf_t *rb, struct ringbuf_ctl *ctl )
 {
-	assert( rb );
-	if ( rb->back > rb->front )
+	rb->ctl = ctl;
+	atomic_init( &ctl->read_want, 0 );
+	atomic_init( &ctl->write_want, 0 );
+	atomic_init( &ctl->read_seq, 0 );
+	atomic_init( &ctl->write_seq, 0 );
+	atomic_init( &ctl->wait_enabled, 0 );
+	ringbuf_reset( rb );
+}
+
+static ringbuf_t *ringbuf_alloc( size_t capacity, int flags, const ringbuf_allocator_t *allocator )
+{
+	/* growing frees the buffer under the other side of an SPSC ring */
+	if ( ( flags & ~RINGBUF_PUBLIC_FLAGS ) || ( ( flags & RINGBUF_GROW ) && ( flags & RINGBUF_SPSC ) ) )
 	{
-		return rb->capacity - ( rb->back - rb->front ) - 1;
+		errno = EINVAL;
+		return NULL;
+	}
+	if ( !allocator )
+		allocator = &ringbuf_default_allocator;
+
+	/* alignment keeps the padded index cache lines to ourselves */
+	ringbuf_t *rb = allocator->alloc( sizeof( ringbuf_t ), alignof( ringbuf_t ), allocator->ctx );
+	if ( rb )
+	{
+
+		rb->alloc = *allocator;
+		rb->stats = NULL;
+
+		rb->flags = flags;
+		if ( ringbuf_setup_buf( rb, capacity ) != 0 )
+		{
+			int err = errno;
+			allocator->free( rb, sizeof( ringbuf_t ), allocator->ctx );
+			errno = err;
+			return NULL;
+		}
+		ringbuf_init_ctl( rb, &rb->local_ctl );
 	}
 	else
 	{
-		return rb->front - rb->back - 1;
+		/* a custom allocator need not set errno */
+		errno = ENOMEM;
 	}
+	return rb;
+}
+
+RINGBUF_API ringbuf_t *ringbuf_new( size_t capacity )
+{
+	return ringbuf_alloc( capacity, 0, NULL );
 }
 
-size_t ringbuf_bytes_used( const ringbuf_t *rb )
+RINGBUF_API ringbuf_t *ringbuf_new_spsc( size_t capacity )
 {
-	return rb->size;
+	return ringbuf_alloc( capacity, RINGBUF_SPSC, NULL );
 }
 
-int ringbuf_is_full( const ringbuf_t *rb )
+RINGBUF_API ringbuf_t *ringbuf_new_mirrored( size_t capacity, int flags )
 {
-	return rb->size == 0;
+	return ringbuf_alloc( capacity, flags | RINGBUF_MIRRORED, NULL );
 }
 
-int ringbuf_is_empty( const ringbuf_t *rb )
+RINGBUF_API ringbuf_t *ringbuf_new_pow2( size_t capacity, int flags )
 {
-	return rb->size == rb->capacity;
+	return ringbuf_alloc( capacity, flags | RINGBUF_POW2, NULL );
 }
 
-const void *ringbuf_back( const ringbuf_t *rb )
+RINGBUF_API ringbuf_t *ringbuf_new_ex( size_t capacity, int flags, const ringbuf_allocator_t *allocator )
 {
-	return rb->back;
+	return ringbuf_alloc( capacity, flags, allocator );
 }
 
-const void *ringbuf_front( const struct ringbuf_t *rb )
+RINGBUF_API int ringbuf_init( ringbuf_t *rb, void *storage, size_t size, int flags )
 {
-	return rb->front;
+	if ( size < 2 || ( flags & ~( RINGBUF_SPSC | RINGBUF_POW2 ) )
+		|| ( ( flags & RINGBUF_POW2 ) && ( size & ( size - 1 ) ) ) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	rb->buf = storage;
+	rb->capacity = size;
+	rb->mask = flags & RINGBUF_POW2 ? size - 1 : SIZE_MAX;
+	rb->flags = flags | RINGBUF_USER_STORAGE;
+	rb->map_size = size;
+	rb->alloc = ringbuf_default_allocator;
+	rb->stats = NULL;
+	ringbuf_init_ctl( rb, &rb->local_ctl );
+	return 0;
 }
 
+#ifdef RINGBUF_POSIX
 /*
- * Given a ring buffer rb and a pointer to a location within its
- * contiguous buffer, return the a pointer to the next logical
- * location in the ring buffer.
+ * Map the header and the buffer (twice, if mirrored) of a shared
+ * memory ring buffer from fd, and wrap them in a new handle.
  */
-static uint8_t *ringbuf_nextp( ringbuf_t *rb, const uint8_t *p )
+static ringbuf_t *ringbuf_map_shm( int fd, size_t header_size, size_t capacity, int flags )
 {
-	/*
-	 * The assert guarantees the expression (++p - rb->buf) is
-	 * non-negative; therefore, the modulus operation is safe and
-	 * portable.
-	 */
-	assert( ( p >= rb->buf ) && ( p < ringbuf_end( rb ) ) );
-	size_t back_offset = ( ++p - rb->buf ) % rb->capacity;
-	return rb->buf + back_offset;
+	size_t map_size = header_size + ( flags & RINGBUF_MIRRORED ? 2 : 1 ) * capacity;
+	uint8_t *base = mmap( NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	if ( base == MAP_FAILED )
+		return NULL;
+
+	/* the mirror half lies past the end of the object until remapped */
+	if ( ( flags & RINGBUF_MIRRORED )
+		&& mmap( base + header_size + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+			   ( off_t )header_size )
+			== MAP_FAILED )
+	{
+		int err = errno;
+		munmap( base, map_size );
+		errno = err;
+		return NULL;
+	}
+
+	ringbuf_t *rb = ringbuf_default_alloc( sizeof( ringbuf_t ), alignof( ringbuf_t ), NULL );
+	if ( !rb )
+	{
+		munmap( base, map_size );
+		errno = ENOMEM;
+		return NULL;
+	}
+	rb->buf = base + header_size;
+	rb->capacity = capacity;
+	rb->mask = capacity - 1;
+	rb->flags = flags | RINGBUF_POW2 | RINGBUF_SHARED;
+	rb->map_size = map_size;
+	rb->alloc = ringbuf_default_allocator;
+	rb->stats = NULL;
+	rb->ctl = &( ( struct ringbuf_shm_header * )base )->ctl;
+	return rb;
 }
+#endif
 
-size_t ringbuf_memset( ringbuf_t *rb, int c, size_t len )
+/*
+ * Size fd for a new, empty, shared memory ring buffer of at least
+ * capacity bytes, write its header and map it.
+ */
+static ringbuf_t *ringbuf_create_shm( int fd, size_t capacity, int flags )
 {
-	const uint8_t *bufend = ringbuf_end( rb );
-	size_t nwritten = 0;
-	size_t count = MIN( len, ringbuf_buffer_size( rb ) );
-	int overflow = count > ringbuf_bytes_free( rb );
+#ifdef RINGBUF_POSIX
+	size_t page = ( size_t )sysconf( _SC_PAGESIZE );
+	size_t header_size = ringbuf_round_up( sizeof( struct ringbuf_shm_header ), page );
+	size_t size;
 
-	while ( nwritten != count )
+	if ( capacity == 0 || capacity > SIZE_MAX / 4 )
 	{
+		errno = EINVAL;
+		return NULL;
+	}
+	/* a power of two of at least a page, so the buffer can be mirrored */
+	size = ringbuf_pow2_ceil( capacity );
+	if ( size < page )
+		size = page;
+	if ( ftruncate( fd, ( off_t )( header_size + size ) ) != 0 )
+		return NULL;
 
-		/* don't copy beyond the end of the buffer */
-		assert( bufend > rb->head );
-		size_t n = MIN( bufend - rb->head, count - nwritten );
-		memset( rb->head, c, n );
-		rb->head += n;
-		nwritten += n;
+	ringbuf_t *rb = ringbuf_map_shm( fd, header_size, size, flags );
+	if ( !rb )
+		return NULL;
+	struct ringbuf_shm_header *header = ( struct ringbuf_shm_header * )( rb->buf - header_size );
+	atomic_store_explicit( &header->magic, 0, memory_order_relaxed );
+	header->version = RINGBUF_SHM_VERSION;
+	header->header_size = header_size;
+	header->capacity = size;
+	header->flags = ( uint32_t )flags;
+	ringbuf_init_ctl( rb, rb->ctl );
+	atomic_store_explicit( &header->magic, RINGBUF_SHM_MAGIC, memory_order_release );
+	return rb;
+#else
+	( void )fd;
+	( void )capacity;
+	( void )flags;
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
 
-		/* wrap? */
-		if ( rb->head == bufend )
-			rb->head = rb->buf;
+RINGBUF_API ringbuf_t *ringbuf_new_shm( int fd, size_t capacity, int flags )
+{
+	if ( flags & ~RINGBUF_MIRRORED )
+	{
+		errno = EINVAL;
+		return NULL;
 	}
+	return ringbuf_create_shm( fd, capacity, flags | RINGBUF_SPSC );
+}
 
-	if ( overflow )
+#ifdef RINGBUF_POSIX
+/*
+ * Check the indices of a shared memory ring buffer that was attached
+ * or recovered from a file, which may have been torn by a crash or be
+ * corrupt. front and back are read as a consistent pair (front again
+ * after back, since a live consumer may be moving it) and must be at
+ * most a buffer apart, or the size queries would underflow; returns
+ * -1 if they are not. Nothing is written: the cached indices belong to
+ * whichever process is the producer or the consumer, which may be
+ * running, and only a recovered file resets them.
+ */
+static int ringbuf_check_ctl( ringbuf_t *rb )
+{
+	struct ringbuf_ctl *ctl = rb->ctl;
+	size_t front, back;
+
+	do
 	{
-		rb->tail = ringbuf_nextp( rb, rb->head );
-		assert( ringbuf_is_full( rb ) );
-	}
+		front = atomic_load_explicit( &ctl->front, memory_order_acquire );
+		back = atomic_load_explicit( &ctl->back, memory_order_acquire );
+	} while ( front != atomic_load_explicit( &ctl->front, memory_order_acquire ) );
 
-	return nwritten;
+	if ( back - front > rb->capacity )
+		return -1;
+	return 0;
 }
 
-void *ringbuf_push_back( ringbuf_t *rb, const void *src, size_t count )
+/*
+ * Reset the state a crashed user of a recovered file left behind,
+ * which nobody else is using: the cached indices, which a power failure
+ * may have written back out of step with the indices they copy, a
+ * threshold nobody waits on any more, and the flag that keeps every
+ * push and pop paying for the fence in ringbuf_notify.
+ */
+static void ringbuf_recover_ctl( ringbuf_t *rb )
 {
-	const uint8_t *u8src = src;
-	const uint8_t *bufend = ringbuf_end( rb );
-	int overflow = count > ringbuf_bytes_free( rb );
-	size_t nread = 0;
+	rb->ctl->front_cache = atomic_load_explicit( &rb->ctl->front, memory_order_relaxed );
+	rb->ctl->back_cache = atomic_load_explicit( &rb->ctl->back, memory_order_relaxed );
+	atomic_store_explicit( &rb->ctl->read_want, 0, memory_order_relaxed );
+	atomic_store_explicit( &rb->ctl->write_want, 0, memory_order_relaxed );
+	atomic_store_explicit( &rb->ctl->wait_enabled, 0, memory_order_relaxed );
+}
+#endif
 
-	while ( nread != count )
+RINGBUF_API ringbuf_t *ringbuf_attach_shm( int fd )
+{
+#ifdef RINGBUF_POSIX
+	struct ringbuf_shm_header header;
+	size_t page = ( size_t )sysconf( _SC_PAGESIZE );
+	struct stat st;
+
+	if ( fstat( fd, &st ) != 0 )
+		return NULL;
+	ssize_t n = pread( fd, &header, offsetof( struct ringbuf_shm_header, ctl ), 0 );
+	if ( n < 0 )
+		return NULL;
+	if ( ( size_t )n < offsetof( struct ringbuf_shm_header, ctl )
+		|| atomic_load_explicit( &header.magic, memory_order_acquire ) != RINGBUF_SHM_MAGIC
+		|| header.version != RINGBUF_SHM_VERSION || header.header_size % page != 0
+		|| header.header_size < sizeof( struct ringbuf_shm_header )
+		|| header.capacity < page || ( header.capacity & ( header.capacity - 1 ) )
+		|| ( header.flags & ~( RINGBUF_SPSC | RINGBUF_MIRRORED ) ) || ( uint64_t )st.st_size != header.header_size + header.capacity )
 	{
-		/* don't copy beyond the end of the buffer */
-		assert( bufend > rb->head );
-		size_t n = MIN( bufend - rb->head, count - nread );
-		memcpy( rb->head, u8src + nread, n );
-		rb->head += n;
-		nread += n;
+		errno = EINVAL;
+		return NULL;
+	}
+	ringbuf_t *rb = ringbuf_map_shm( fd, header.header_size, header.capacity, ( int )header.flags );
+	if ( rb && ringbuf_check_ctl( rb ) != 0 )
+	{
+		ringbuf_free( rb );
+		errno = EINVAL;
+		return NULL;
+	}
+	return rb;
+#else
+	( void )fd;
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
 
-		/* wrap? */
-		if ( rb->head == bufend )
-			rb->head = rb->buf;
+RINGBUF_API ringbuf_t *ringbuf_open_file( const char *path, size_t capacity, int flags )
+{
+#ifdef RINGBUF_POSIX
+	struct stat st;
+	ringbuf_t *rb = NULL;
+
+	if ( flags & ~( RINGBUF_SPSC | RINGBUF_MIRRORED ) )
+	{
+		errno = EINVAL;
+		return NULL;
 	}
 
-	if ( overflow )
+	/* only a file created here is removed again if setting it up fails */
+	int created = 0;
+	int fd = open( path, O_RDWR | O_CLOEXEC );
+	if ( fd < 0 && errno == ENOENT )
 	{
-		rb->tail = ringbuf_nextp( rb, rb->head );
-		assert( ringbuf_is_full( rb ) );
+		fd = open( path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0666 );
+		created = fd >= 0;
+	}
+	if ( fd < 0 )
+		return NULL;
+	if ( fstat( fd, &st ) == 0 )
+	{
+		if ( st.st_size == 0 )
+			rb = ringbuf_create_shm( fd, capacity, flags );
+		else if ( ( rb = ringbuf_attach_shm( fd ) ) != NULL )
+			ringbuf_recover_ctl( rb );
 	}
 
-	return rb->head;
+	/* the mapping keeps the file open */
+	int err = errno;
+	if ( !rb && created )
+		unlink( path );
+	close( fd );
+	errno = err;
+	return rb;
+#else
+	( void )path;
+	( void )capacity;
+	( void )flags;
+	errno = ENOSYS;
+	return NULL;
+#endif
 }
 
-void *ringbuf_memcpy_from( void *rb, ringbuf_t *src, size_t count )
+RINGBUF_API int ringbuf_sync( ringbuf_t *rb )
 {
-	size_t bytes_used = ringbuf_bytes_used( src );
-	if ( count > bytes_used )
+#ifdef RINGBUF_POSIX
+	if ( !( rb->flags & RINGBUF_SHARED ) )
 		return 0;
 
-	uint8_t *u8dst = rb;
-	const uint8_t *bufend = ringbuf_end( src );
-	size_t nwritten = 0;
-	while ( nwritten != count )
+	/* the data first, so that the indices written after it cover it */
+	uint8_t *base = ( uint8_t * )rb->ctl - offsetof( struct ringbuf_shm_header, ctl );
+	if ( msync( rb->buf, rb->capacity, MS_SYNC ) != 0 || msync( base, ( size_t )( rb->buf - base ), MS_SYNC ) != 0 )
+		return -1;
+#else
+	( void )rb;
+#endif
+	return 0;
+}
+
+RINGBUF_API size_t ringbuf_buffer_capacity( const ringbuf_t *rb )
+{
+	return rb->capacity;
+}
+
+RINGBUF_API size_t ringbuf_capacity( const ringbuf_t *rb )
+{
+	if ( rb->flags & RINGBUF_POW2 )
+		return rb->capacity;
+	return rb->capacity - 1;
+}
+
+RINGBUF_API void ringbuf_reset( ringbuf_t *rb )
+{
+	atomic_store_explicit( &rb->ctl->front, 0, memory_order_relaxed );
+	atomic_store_explicit( &rb->ctl->back, 0, memory_order_relaxed );
+	rb->ctl->back_cache = rb->ctl->front_cache = 0;
+}
+
+RINGBUF_API void ringbuf_free( ringbuf_t *rb )
+{
+	assert( rb );
+	ringbuf_allocator_t alloc = rb->alloc;
+	if ( rb->stats )
+		alloc.free( rb->stats, sizeof( *rb->stats ), alloc.ctx );
+	rb->stats = NULL;
+#ifdef RINGBUF_POSIX
+	if ( rb->flags & RINGBUF_READ_EVENT )
+		close( rb->read_event );
+	if ( rb->flags & RINGBUF_WRITE_EVENT )
+		close( rb->write_event );
+#endif
+	rb->flags &= ~( RINGBUF_READ_EVENT | RINGBUF_WRITE_EVENT );
+	if ( rb->flags & RINGBUF_USER_STORAGE )
+		return;
+	ringbuf_free_buf( rb );
+	alloc.free( rb, sizeof( ringbuf_t ), alloc.ctx );
+	rb = NULL;
+}
+
+/*
+ * Return a pointer to one-past-the-end of the ring buffer's
+ * contiguous buffer. You shouldn't normally need to use this function
+ * unless you're writing a new ringbuf_* function.
+ *
+ * For a mirrored ring buffer this is the end of the second mapping, so
+ * the copy loops below never need to split a copy of up to
+ * ringbuf_buffer_capacity bytes and finish in a single iteration.
+ */
+static const uint8_t *ringbuf_end( const ringbuf_t *rb )
+{
+	if ( rb->flags & RINGBUF_MIRRORED )
+		return rb->buf + 2 * rb->capacity;
+	return rb->buf + rb->capacity;
+}
+
+/*
+ * Return a pointer to the byte that index i refers to.
+ */
+static uint8_t *ringbuf_at( const ringbuf_t *rb, size_t i )
+{
+	return rb->buf + ( i & rb->mask );
+}
+
+/*
+ * Number of bytes between a front and a back index. Every size
+ * calculation goes through here so that a consistent pair of indices
+ * is always used.
+ */
+static size_t ringbuf_used( const ringbuf_t *rb, size_t front, size_t back )
+{
+	if ( rb->flags & RINGBUF_POW2 )
+		return back - front;
+
+	assert( front < rb->capacity && back < rb->capacity );
+	if ( back >= front )
+		return back - front;
+	else
+		return rb->capacity - front + back;
+}
+
+static size_t ringbuf_unused( const ringbuf_t *rb, size_t front, size_t back )
+{
+	return ringbuf_capacity( rb ) - ringbuf_used( rb, front, back );
+}
+
+/*
+ * Advance an index by n bytes, wrapping at the end of the buffer. A
+ * compare and subtract is cheaper than a modulus, and a power-of-two
+ * buffer needs neither. i + n never exceeds 2 * capacity: n is at most
+ * one buffer, or, for a mirrored buffer, a copy running up to the end
+ * of the second mapping.
+ */
+static size_t ringbuf_advance( const ringbuf_t *rb, size_t i, size_t n )
+{
+	if ( rb->flags & RINGBUF_POW2 )
+		return i + n;
+
+	assert( i < rb->capacity && i + n <= 2 * rb->capacity );
+	i += n;
+	if ( i >= rb->capacity )
+		i -= rb->capacity;
+	if ( i >= rb->capacity )
+		i -= rb->capacity;
+	return i;
+}
+
+/*
+ * Producer side view of the free space. The cached front index is
+ * only refreshed (an acquire load of the consumer's cache line) when
+ * it claims there is not enough room for count bytes.
+ */
+static size_t ringbuf_producer_free( ringbuf_t *rb, size_t back, size_t count )
+{
+	size_t nfree = ringbuf_unused( rb, rb->ctl->front_cache, back );
+	if ( nfree < count )
 	{
-		assert( bufend > src->tail );
-		size_t n = MIN( bufend - src->tail, count - nwritten );
-		memcpy( u8dst + nwritten, src->tail, n );
-		src->tail += n;
-		nwritten += n;
+		rb->ctl->front_cache = atomic_load_explicit( &rb->ctl->front, memory_order_acquire );
+		nfree = ringbuf_unused( rb, rb->ctl->front_cache, back );
+	}
+	return nfree;
+}
 
-		/* wrap ? */
-		if ( src->tail == bufend )
-			src->tail = src->buf;
+/* Consumer side view of the used space, see ringbuf_producer_free. */
+static size_t ringbuf_consumer_used( ringbuf_t *rb, size_t front, size_t count )
+{
+	size_t nused = ringbuf_used( rb, front, rb->ctl->back_cache );
+	if ( nused < count )
+	{
+		rb->ctl->back_cache = atomic_load_explicit( &rb->ctl->back, memory_order_acquire );
+		nused = ringbuf_used( rb, front, rb->ctl->back_cache );
 	}
+	return nused;
+}
 
-	assert( count + ringbuf_bytes_used( src ) == bytes_used );
-	return src->tail;
+/*
+ * Sleep on a futex word as long as it still holds val, for at most
+ * timeout (or indefinitely if timeout is NULL), and wake every thread
+ * sleeping on it. The futexes are process private unless the ring
+ * buffer is in shared memory. Without futexes the waiter just naps and
+ * rechecks.
+ */
+static void ringbuf_futex_wait( const ringbuf_t *rb, atomic_uint *word, unsigned val, const struct timespec *timeout )
+{
+#ifdef __linux__
+	int op = rb->flags & RINGBUF_SHARED ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE;
+	syscall( SYS_futex, word, op, val, timeout, NULL, 0 );
+#else
+	( void )rb;
+	struct timespec nap = { 0, 1000000 };
+	if ( timeout && timeout->tv_sec == 0 && timeout->tv_nsec < nap.tv_nsec )
+		nap = *timeout;
+	if ( atomic_load( word ) == val )
+		nanosleep( &nap, NULL );
+#endif
 }
 
-void *ringbuf_copy( ringbuf_t *dst, ringbuf_t *src, size_t count )
+static void ringbuf_futex_wake( const ringbuf_t *rb, atomic_uint *word )
 {
-	size_t src_bytes_used = ringbuf_bytes_used( src );
-	if ( count > src_bytes_used )
-		return 0;
-	int overflow = count > ringbuf_bytes_free( dst );
+#ifdef __linux__
+	int op = rb->flags & RINGBUF_SHARED ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE;
+	syscall( SYS_futex, word, op, INT_MAX, NULL, NULL, 0 );
+#else
+	( void )rb;
+	( void )word;
+#endif
+}
 
-	const uint8_t *src_bufend = ringbuf_end( src );
-	const uint8_t *dst_bufend = ringbuf_end( dst );
-	size_t ncopied = 0;
-	while ( ncopied != count )
+/*
+ * Called after an index has been published: wake the thread waiting
+ * on want/seq if the space it is waiting for (avail, computed only
+ * when somebody actually waits) has reached its threshold.
+ *
+ * The fence orders the index store before the load of want, and pairs
+ * with the fence in ringbuf_wait, so that either the waiter sees the
+ * new index or this sees the waiter's threshold. It is only needed
+ * once a thread has waited on the ring buffer (see ringbuf_wait_enable)
+ * or an eventfd is attached; until then the cost is a relaxed load and
+ * a test of the flags, and there is never a system call while nobody
+ * is waiting.
+ */
+static void ringbuf_notify( ringbuf_t *rb, atomic_size_t *want, atomic_uint *seq,
+	size_t ( *avail )( const ringbuf_t * ) )
+{
+	if ( !atomic_load_explicit( &rb->ctl->wait_enabled, memory_order_relaxed )
+		&& !( rb->flags & ( RINGBUF_READ_EVENT | RINGBUF_WRITE_EVENT ) ) )
+		return;
+	atomic_thread_fence( memory_order_seq_cst );
+	size_t n = atomic_load_explicit( want, memory_order_relaxed );
+	if ( n == 0 || avail( rb ) < n )
+		return;
+
+	/* only the thread that disarms the waiter wakes it */
+	if ( atomic_compare_exchange_strong( want, &n, 0 ) )
 	{
-		assert( src_bufend > src->tail );
-		size_t nsrc = MIN( src_bufend - src->tail, count - ncopied );
-		assert( dst_bufend > dst->head );
-		size_t n = MIN( dst_bufend - dst->head, nsrc );
-		memcpy( dst->head, src->tail, n );
-		src->tail += n;
-		dst->head += n;
-		ncopied += n;
+		atomic_fetch_add_explicit( seq, 1, memory_order_release );
+		ringbuf_futex_wake( rb, seq );
+	}
+}
+
+/*
+ * Signal an event fd if the space it watches went from below mark to
+ * mark or more. Called after ringbuf_notify, whose fence also pairs
+ * the index store here with the other side's: of a push and a pop that
+ * race, at least one sees the other's index, so a crossing is never
+ * missed by both.
+ */
+static void ringbuf_event_edge( int fd, size_t mark, size_t before, size_t after )
+{
+#ifdef __linux__
+	uint64_t one = 1;
+	if ( before < mark && after >= mark && write( fd, &one, sizeof( one ) ) < 0 )
+		assert( errno == EAGAIN );
+#else
+	( void )fd;
+	( void )mark;
+	( void )before;
+	( void )after;
+#endif
+}
 
-		/* wrap ? */
-		if ( src->tail == src_bufend )
-			src->tail = src->buf;
-		if ( dst->head == dst_bufend )
-			dst->head = dst->buf;
+/*
+ * Publish a new front index, waking a producer waiting for free space.
+ */
+static void ringbuf_publish_front( ringbuf_t *rb, size_t front )
+{
+	size_t old = atomic_load_explicit( &rb->ctl->front, memory_order_relaxed );
+	atomic_store_explicit( &rb->ctl->front, front, memory_order_release );
+	ringbuf_notify( rb, &rb->ctl->write_want, &rb->ctl->write_seq, ringbuf_bytes_free );
+	if ( rb->flags & RINGBUF_WRITE_EVENT )
+	{
+		size_t back = atomic_load_explicit( &rb->ctl->back, memory_order_acquire );
+		ringbuf_event_edge( rb->write_event, rb->write_mark, ringbuf_unused( rb, old, back ),
+			ringbuf_unused( rb, front, back ) );
 	}
+}
+
+/*
+ * Before a push of count bytes at back overwrites the oldest data (only
+ * possible outside of SPSC mode), move front past everything the push
+ * is about to write over. A file-backed ring buffer left behind by a
+ * crash mid-push then never claims bytes that were half overwritten.
+ * A push of a whole buffer or more empties the ring buffer instead.
+ */
+static void ringbuf_drop_front( ringbuf_t *rb, size_t back, size_t count )
+{
+	size_t front;
 
-	assert( count + ringbuf_bytes_used( src ) == src_bytes_used );
+	assert( !( rb->flags & RINGBUF_SPSC ) );
+	if ( count >= ringbuf_capacity( rb ) )
+		front = back;
+	else if ( rb->flags & RINGBUF_POW2 )
+		front = back + count - rb->capacity;
+	else
+		front = ringbuf_advance( rb, back, count + 1 );
+	atomic_store_explicit( &rb->ctl->front, front, memory_order_release );
+	rb->ctl->front_cache = front;
+}
 
+/*
+ * Publish a new back index, waking a consumer waiting for data. On
+ * overflow (only possible outside of SPSC mode) ringbuf_drop_front has
+ * already dropped the oldest data, before is how many bytes were used
+ * until then, and front ends up just after back (or exactly one buffer
+ * behind it, for a power-of-two buffer), which leaves the buffer full.
+ */
+static void ringbuf_publish_back( ringbuf_t *rb, size_t back, int overflow, size_t before )
+{
+	size_t old = atomic_load_explicit( &rb->ctl->back, memory_order_relaxed );
+	if ( overflow )
+	{
+		/*
+		 * front goes first: it is already past the overwritten bytes
+		 * unless a whole buffer was pushed, and either way a crash
+		 * between the two stores leaves a file-backed ring buffer
+		 * holding at most a buffer's worth, not an impossible
+		 * back - front
+		 */
+		size_t front;
+		if ( rb->flags & RINGBUF_POW2 )
+			front = back - rb->capacity;
+		else
+			front = ringbuf_advance( rb, back, 1 );
+		atomic_store_explicit( &rb->ctl->front, front, memory_order_release );
+		rb->ctl->front_cache = front;
+	}
+	atomic_store_explicit( &rb->ctl->back, back, memory_order_release );
+	ringbuf_notify( rb, &rb->ctl->read_want, &rb->ctl->read_seq, ringbuf_bytes_used );
 	if ( overflow )
 	{
-		dst->tail = ringbuf_nextp( dst, dst->head );
-		assert( ringbuf_is_full( dst ) );
+		rb->ctl->back_cache = back;
+		assert( ringbuf_is_full( rb ) );
+	}
+	if ( rb->flags & RINGBUF_READ_EVENT )
+	{
+		size_t front = atomic_load_explicit( &rb->ctl->front, memory_order_acquire );
+		if ( !overflow )
+			before = ringbuf_used( rb, front, old );
+		ringbuf_event_edge( rb->read_event, rb->read_mark, before, ringbuf_used( rb, front, back ) );
 	}
+}
 
-	return dst->head;
+RINGBUF_API size_t ringbuf_bytes_free( const ringbuf_t *rb )
+{
+	assert( rb );
+	size_t front = atomic_load_explicit( &rb->ctl->front, memory_order_acquire );
+	size_t back = atomic_load_explicit( &rb->ctl->back, memory_order_acquire );
+	return ringbuf_unused( rb, front, back );
+}
+
+RINGBUF_API size_t ringbuf_bytes_used( const ringbuf_t *rb )
+{
+	assert( rb );
+	size_t front = atomic_load_explicit( &rb->ctl->front, memory_order_acquire );
+	size_t back = atomic_load_explicit( &rb->ctl->back, memory_order_acquire );
+	return ringbuf_used( rb, front, back );
+}
+
+RINGBUF_API int ringbuf_is_full( const ringbuf_t *rb )
+{
+	return ringbuf_bytes_free( rb ) == 0;
+}
+
+RINGBUF_API int ringbuf_is_empty( const ringbuf_t *rb )
+{
+	return ringbuf_bytes_used( rb ) == 0;
+}
+
+RINGBUF_API const void *ringbuf_back( const ringbuf_t *rb )
+{
+	return ringbuf_at( rb, atomic_load_explicit( &rb->ctl->back, memory_order_acquire ) );
+}
+
+RINGBUF_API const void *ringbuf_front( const struct ringbuf_t *rb )
+{
+	return ringbuf_at( rb, atomic_load_explicit( &rb->ctl->front, memory_order_acquire ) );
+}
+
+static void ringbuf_stat_add( atomic_uint_least64_t *counter, uint64_t n )
+{
+	atomic_store_explicit( counter, atomic_load_explicit( counter, memory_order_relaxed ) + n, memory_order_relaxed );
+}
+
+/* count bytes were pushed, lost of them (or of older data) overwritten */
+static void ringbuf_stats_push( ringbuf_t *rb, size_t count, size_t lost )
+{
+	struct ringbuf_stats_state *st = rb->stats;
+	if ( !st )
+		return;
+
+	ringbuf_stat_add( &st->bytes_in, count );
+	if ( lost )
+	{
+		ringbuf_stat_add( &st->overflows, 1 );
+		ringbuf_stat_add( &st->bytes_lost, lost );
+	}
+	size_t used = ringbuf_bytes_used( rb );
+	if ( used > atomic_load_explicit( &st->high_water, memory_order_relaxed ) )
+		atomic_store_explicit( &st->high_water, used, memory_order_relaxed );
+}
+
+/* count bytes were popped; the histogram records what was left */
+static void ringbuf_stats_pop( ringbuf_t *rb, size_t count )
+{
+	struct ringbuf_stats_state *st = rb->stats;
+	if ( !st )
+		return;
+
+	ringbuf_stat_add( &st->bytes_out, count );
+	size_t used = ringbuf_bytes_used( rb );
+	if ( used < atomic_load_explicit( &st->low_water, memory_order_relaxed ) )
+		atomic_store_explicit( &st->low_water, used, memory_order_relaxed );
+	ringbuf_stat_add( &st->histogram[ ( size_t )( used * st->bin_scale ) ], 1 );
+}
+
+static void ringbuf_stats_refused( atomic_uint_least64_t *counter )
+{
+	ringbuf_stat_add( counter, 1 );
+}
+
+RINGBUF_API int ringbuf_stats_enable( ringbuf_t *rb )
+{
+	if ( rb->stats )
+		return 0;
+
+	/* RINGBUF_DECLARE leaves the allocator unset */
+	if ( !rb->alloc.alloc )
+		rb->alloc = ringbuf_default_allocator;
+
+	struct ringbuf_stats_state *st = rb->alloc.alloc( sizeof( *st ), alignof( struct ringbuf_stats_state ), rb->alloc.ctx );
+	if ( !st )
+		return -1;
+
+	/* capacity + 1 keeps a full buffer in the last bin */
+	st->bin_scale = ( double )RINGBUF_STATS_BINS / ( ringbuf_capacity( rb ) + 1 );
+	atomic_init( &st->bytes_in, 0 );
+	atomic_init( &st->overflows, 0 );
+	atomic_init( &st->bytes_lost, 0 );
+	atomic_init( &st->push_refusals, 0 );
+	atomic_init( &st->high_water, ringbuf_bytes_used( rb ) );
+	atomic_init( &st->bytes_out, 0 );
+	atomic_init( &st->pop_refusals, 0 );
+	atomic_init( &st->low_water, ringbuf_capacity( rb ) );
+	for ( int i = 0; i < RINGBUF_STATS_BINS; ++i )
+		atomic_init( &st->histogram[ i ], 0 );
+	rb->stats = st;
+	return 0;
+}
+
+RINGBUF_API int ringbuf_stats_snapshot( const ringbuf_t *rb, ringbuf_stats_t *out )
+{
+	const struct ringbuf_stats_state *st = rb->stats;
+	if ( !st )
+		return -1;
+
+	out->capacity = ringbuf_capacity( rb );
+	out->bytes_used = ringbuf_bytes_used( rb );
+	out->bytes_in = atomic_load_explicit( &st->bytes_in, memory_order_relaxed );
+	out->bytes_out = atomic_load_explicit( &st->bytes_out, memory_order_relaxed );
+	out->overflows = atomic_load_explicit( &st->overflows, memory_order_relaxed );
+	out->bytes_lost = atomic_load_explicit( &st->bytes_lost, memory_order_relaxed );
+	out->push_refusals = atomic_load_explicit( &st->push_refusals, memory_order_relaxed );
+	out->pop_refusals = atomic_load_explicit( &st->pop_refusals, memory_order_relaxed );
+	out->high_water = atomic_load_explicit( &st->high_water, memory_order_relaxed );
+	out->low_water = atomic_load_explicit( &st->low_water, memory_order_relaxed );
+	for ( int i = 0; i < RINGBUF_STATS_BINS; ++i )
+		out->histogram[ i ] = atomic_load_explicit( &st->histogram[ i ], memory_order_relaxed );
+	return 0;
+}
+
+/*
+ * Decide what a producer does about count bytes that do not fit into
+ * the nfree bytes it found at back: grow the buffer (RINGBUF_GROW),
+ * refuse (RINGBUF_SPSC, or when growing fails) or overwrite the oldest
+ * data, which is dropped from the front before the caller writes over
+ * it. Returns 0 to go ahead, with back and nfree updated if the buffer
+ * grew, or -1 to refuse.
+ */
+static int ringbuf_overflow( ringbuf_t *rb, size_t *back, size_t *nfree, size_t count )
+{
+	if ( count <= *nfree )
+		return 0;
+
+	if ( rb->flags & RINGBUF_GROW )
+	{
+		size_t grown = 2 * ringbuf_capacity( rb );
+		size_t needed = ringbuf_capacity( rb ) - *nfree + count;
+		if ( ringbuf_reserve( rb, grown > needed ? grown : needed ) == 0 )
+		{
+			*back = atomic_load_explicit( &rb->ctl->back, memory_order_relaxed );
+			*nfree = ringbuf_producer_free( rb, *back, count );
+			return 0;
+		}
+	}
+	else if ( !( rb->flags & RINGBUF_SPSC ) )
+	{
+		ringbuf_drop_front( rb, *back, count );
+		return 0;
+	}
+
+	if ( rb->stats )
+		ringbuf_stats_refused( &rb->stats->push_refusals );
+	return -1;
+}
+
+RINGBUF_API size_t ringbuf_memset( ringbuf_t *rb, int c, size_t len )
+{
+	size_t back = atomic_load_explicit( &rb->ctl->back, memory_order_relaxed );
+	size_t nwritten = 0;
+	size_t count = rb->flags & RINGBUF_GROW ? len : ringbuf_min( len, ringbuf_buffer_capacity( rb ) );
+	size_t nfree = ringbuf_producer_free( rb, back, count );
+
+	if ( ringbuf_overflow( rb, &back, &nfree, count ) != 0 )
+		return 0;
+	const uint8_t *bufend = ringbuf_end( rb );
+	int overflow = count > nfree;
+
+	while ( nwritten != count )
+	{
+
+		/* don't copy beyond the end of the buffer */
+		assert( bufend > ringbuf_at( rb, back ) );
+		size_t n = ringbuf_min( ( size_t )( bufend - ringbuf_at( rb, back ) ), count - nwritten );
+		memset( ringbuf_at( rb, back ), c, n );
+		back = ringbuf_advance( rb, back, n );
+		nwritten += n;
+	}
+
+	ringbuf_publish_back( rb, back, overflow, ringbuf_capacity( rb ) - nfree );
+	ringbuf_stats_push( rb, count, overflow ? count - nfree : 0 );
+	return nwritten;
+}
+
+RINGBUF_API void *ringbuf_push_back( ringbuf_t *rb, const void *src, size_t count )
+{
+	const uint8_t *u8src = src;
+	size_t back = atomic_load_explicit( &rb->ctl->back, memory_order_relaxed );
+	size_t nfree = ringbuf_producer_free( rb, back, count );
+	size_t nread = 0;
+
+	if ( ringbuf_overflow( rb, &back, &nfree, count ) != 0 )
+		return NULL;
+	const uint8_t *bufend = ringbuf_end( rb );
+	int overflow = count > nfree;
+
+	while ( nread != count )
+	{
+		/* don't copy beyond the end of the buffer */
+		assert( bufend > ringbuf_at( rb, back ) );
+		size_t n = ringbuf_min( ( size_t )( bufend - ringbuf_at( rb, back ) ), count - nread );
+		memcpy( ringbuf_at( rb, back ), u8src + nread, n );
+		back = ringbuf_advance( rb, back, n );
+		nread += n;
+	}
+
+	ringbuf_publish_back( rb, back, overflow, ringbuf_capacity( rb ) - nfree );
+	ringbuf_stats_push( rb, count, overflow ? count - nfree : 0 );
+	return ringbuf_at( rb, back );
+}
+
+/*
+ * Copy count bytes starting at index front out into the contiguous
+ * area out, and return the index just after them. The caller has
+ * checked that they are there.
+ */
+static size_t ringbuf_copy_out( const ringbuf_t *rb, size_t front, void *out, size_t count )
+{
+	uint8_t *u8dst = out;
+	const uint8_t *bufend = ringbuf_end( rb );
+	size_t nwritten = 0;
+	while ( nwritten != count )
+	{
+		assert( bufend > ringbuf_at( rb, front ) );
+		size_t n = ringbuf_min( ( size_t )( bufend - ringbuf_at( rb, front ) ), count - nwritten );
+		memcpy( u8dst + nwritten, ringbuf_at( rb, front ), n );
+		front = ringbuf_advance( rb, front, n );
+		nwritten += n;
+	}
+	return front;
+}
+
+RINGBUF_API void *ringbuf_pop_front( void *out, ringbuf_t *rb, size_t count )
+{
+	size_t front = atomic_load_explicit( &rb->ctl->front, memory_order_relaxed );
+	size_t bytes_used = ringbuf_consumer_used( rb, front, count );
+	if ( count > bytes_used )
+	{
+		if ( rb->stats )
+			ringbuf_stats_refused( &rb->stats->pop_refusals );
+		return 0;
+	}
+
+	front = ringbuf_copy_out( rb, front, out, count );
+	ringbuf_publish_front( rb, front );
+	ringbuf_stats_pop( rb, count );
+	return ringbuf_at( rb, front );
+}
+
+RINGBUF_API size_t ringbuf_peek_at( ringbuf_t *rb, size_t offset, void *dst, size_t count )
+{
+	size_t front = atomic_load_explicit( &rb->ctl->front, memory_order_relaxed );
+	size_t bytes_used = ringbuf_consumer_used( rb, front, offset + count );
+	if ( offset > bytes_used || count > bytes_used - offset )
+		return 0;
+
+	ringbuf_copy_out( rb, ringbuf_advance( rb, front, offset ), dst, count );
+	return count;
+}
+
+RINGBUF_API size_t ringbuf_skip( ringbuf_t *rb, size_t count )
+{
+	size_t front = atomic_load_explicit( &rb->ctl->front, memory_order_relaxed );
+	size_t used = ringbuf_consumer_used( rb, front, count );
+	count = ringbuf_min( count, used );
+	if ( count )
+	{
+		ringbuf_publish_front( rb, ringbuf_advance( rb, front, count ) );
+		ringbuf_stats_pop( rb, count );
+	}
+	return count;
+}
+
+/*
+ * Copy count bytes from index front of src to index back of dst,
+ * splitting the copy wherever either buffer wraps, and return the
+ * index just after them in dst. The caller has checked that there is
+ * enough data in src, and decided what to do about the room in dst.
+ */
+static size_t ringbuf_copy_between( ringbuf_t *dst, size_t back, const ringbuf_t *src, size_t front, size_t count )
+{
+	const uint8_t *src_bufend = ringbuf_end( src );
+	const uint8_t *dst_bufend = ringbuf_end( dst );
+	size_t ncopied = 0;
+	while ( ncopied != count )
+	{
+		assert( src_bufend > ringbuf_at( src, front ) );
+		size_t nsrc = ringbuf_min( ( size_t )( src_bufend - ringbuf_at( src, front ) ), count - ncopied );
+		assert( dst_bufend > ringbuf_at( dst, back ) );
+		size_t n = ringbuf_min( ( size_t )( dst_bufend - ringbuf_at( dst, back ) ), nsrc );
+		memcpy( ringbuf_at( dst, back ), ringbuf_at( src, front ), n );
+		front = ringbuf_advance( src, front, n );
+		back = ringbuf_advance( dst, back, n );
+		ncopied += n;
+	}
+	return back;
+}
+
+/*
+ * Copy count bytes starting offset bytes past src's front into dst,
+ * consuming them from src if consume is set. This is ringbuf_copy and
+ * ringbuf_copy_at.
+ */
+static void *ringbuf_transfer( ringbuf_t *dst, ringbuf_t *src, size_t offset, size_t count, int consume )
+{
+	size_t front = atomic_load_explicit( &src->ctl->front, memory_order_relaxed );
+	size_t src_bytes_used = ringbuf_consumer_used( src, front, offset + count );
+	if ( offset > src_bytes_used || count > src_bytes_used - offset )
+	{
+		if ( consume && src->stats )
+			ringbuf_stats_refused( &src->stats->pop_refusals );
+		return 0;
+	}
+
+	size_t back = atomic_load_explicit( &dst->ctl->back, memory_order_relaxed );
+	size_t nfree = ringbuf_producer_free( dst, back, count );
+	if ( ringbuf_overflow( dst, &back, &nfree, count ) != 0 )
+		return 0;
+	int overflow = count > nfree;
+
+	front = ringbuf_advance( src, front, offset );
+	back = ringbuf_copy_between( dst, back, src, front, count );
+	if ( consume )
+	{
+		ringbuf_publish_front( src, ringbuf_advance( src, front, count ) );
+		ringbuf_stats_pop( src, count );
+	}
+	ringbuf_publish_back( dst, back, overflow, ringbuf_capacity( dst ) - nfree );
+	ringbuf_stats_push( dst, count, overflow ? count - nfree : 0 );
+	return ringbuf_at( dst, back );
+}
+
+RINGBUF_API void *ringbuf_copy( ringbuf_t *dst, ringbuf_t *src, size_t count )
+{
+	return ringbuf_transfer( dst, src, 0, count, 1 );
+}
+
+RINGBUF_API void *ringbuf_copy_at( ringbuf_t *dst, ringbuf_t *src, size_t offset, size_t count )
+{
+	return ringbuf_transfer( dst, src, offset, count, 0 );
+}
+
+/*
+ * Describe count bytes starting at offset i as at most two
+ * contiguous spans, splitting at the end of the buffer. Returns the
+ * number of spans that are not empty.
+ */
+static int ringbuf_spans( const ringbuf_t *rb, size_t i, size_t count, ringbuf_span_t span[ 2 ] )
+{
+	const uint8_t *bufend = ringbuf_end( rb );
+	size_t n = ringbuf_min( ( size_t )( bufend - ringbuf_at( rb, i ) ), count );
+	span[ 0 ].data = ringbuf_at( rb, i );
+	span[ 0 ].len = n;
+	span[ 1 ].data = rb->buf;
+	span[ 1 ].len = count - n;
+	return ( n != 0 ) + ( span[ 1 ].len != 0 );
+}
+
+RINGBUF_API size_t ringbuf_write_reserve( ringbuf_t *rb, size_t count, ringbuf_span_t span[ 2 ] )
+{
+	size_t back = atomic_load_explicit( &rb->ctl->back, memory_order_relaxed );
+	size_t nfree = ringbuf_producer_free( rb, back, count );
+	count = ringbuf_min( count, nfree );
+	ringbuf_spans( rb, back, count, span );
+	return count;
+}
+
+RINGBUF_API void ringbuf_write_commit( ringbuf_t *rb, size_t count )
+{
+	size_t back = atomic_load_explicit( &rb->ctl->back, memory_order_relaxed );
+	assert( count <= ringbuf_producer_free( rb, back, count ) );
+	ringbuf_publish_back( rb, ringbuf_advance( rb, back, count ), 0, 0 );
+	ringbuf_stats_push( rb, count, 0 );
+}
+
+RINGBUF_API size_t ringbuf_read_peek( ringbuf_t *rb, size_t count, ringbuf_span_t span[ 2 ] )
+{
+	size_t front = atomic_load_explicit( &rb->ctl->front, memory_order_relaxed );
+	size_t used = ringbuf_consumer_used( rb, front, count );
+	count = ringbuf_min( count, used );
+	ringbuf_spans( rb, front, count, span );
+	return count;
+}
+
+RINGBUF_API void ringbuf_read_consume( ringbuf_t *rb, size_t count )
+{
+	size_t front = atomic_load_explicit( &rb->ctl->front, memory_order_relaxed );
+	assert( count <= ringbuf_consumer_used( rb, front, count ) );
+	ringbuf_publish_front( rb, ringbuf_advance( rb, front, count ) );
+	ringbuf_stats_pop( rb, count );
+}
+
+/*
+ * Describe the used bytes from offset (past the front pointer) onwards
+ * as at most two spans, and return the number of used bytes. An offset
+ * beyond them leaves the spans empty. Consumer side.
+ */
+static size_t ringbuf_used_spans( ringbuf_t *rb, size_t offset, ringbuf_span_t span[ 2 ] )
+{
+	size_t front = atomic_load_explicit( &rb->ctl->front, memory_order_relaxed );
+	size_t used = ringbuf_consumer_used( rb, front, SIZE_MAX );
+	offset = ringbuf_min( offset, used );
+	ringbuf_spans( rb, ringbuf_advance( rb, front, offset ), used - offset, span );
+	return used;
+}
+
+RINGBUF_API size_t ringbuf_find_byte( ringbuf_t *rb, int c, size_t offset )
+{
+	ringbuf_span_t span[ 2 ];
+	size_t used = ringbuf_used_spans( rb, offset, span );
+	size_t base = used - span[ 0 ].len - span[ 1 ].len;
+
+	for ( int i = 0; i < 2; ++i )
+	{
+		const uint8_t *hit = memchr( span[ i ].data, c, span[ i ].len );
+		if ( hit )
+			return base + ( size_t )( hit - ( const uint8_t * )span[ i ].data );
+		base += span[ i ].len;
+	}
+	return used;
+}
+
+RINGBUF_API size_t ringbuf_find_pattern( ringbuf_t *rb, const void *pattern, size_t len, size_t offset )
+{
+	const uint8_t *pat = pattern;
+	ringbuf_span_t span[ 2 ];
+	size_t used = ringbuf_used_spans( rb, offset, span );
+	size_t base = used - span[ 0 ].len - span[ 1 ].len;
+	const uint8_t *s0 = span[ 0 ].data, *s1 = span[ 1 ].data;
+	size_t n0 = span[ 0 ].len, n1 = span[ 1 ].len;
+	const uint8_t *hit;
+
+	if ( len == 0 )
+		return base;
+
+	/* matches within the first span */
+	hit = memmem( s0, n0, pat, len );
+	if ( hit )
+		return base + ( size_t )( hit - s0 );
+
+	if ( n1 )
+	{
+		/* matches that start in the last len - 1 bytes of the first span and run on into the second */
+		size_t i = n0 > len - 1 ? n0 - ( len - 1 ) : 0;
+		while ( ( hit = memchr( s0 + i, pat[ 0 ], n0 - i ) ) != NULL )
+		{
+			i = ( size_t )( hit - s0 );
+			size_t head = n0 - i;
+			if ( len - head <= n1 && memcmp( hit, pat, head ) == 0 && memcmp( s1, pat + head, len - head ) == 0 )
+				return base + i;
+			++i;
+		}
+
+		/* matches within the second span */
+		hit = memmem( s1, n1, pat, len );
+		if ( hit )
+			return base + n0 + ( size_t )( hit - s1 );
+	}
+
+	/* the first offset at which a match could still turn up */
+	return n0 + n1 >= len ? used - ( len - 1 ) : base;
+}
+
+/*
+ * Move the contents of the ring buffer into a new internal buffer of
+ * at least capacity (and at least ringbuf_bytes_used) usable bytes,
+ * with one copy of each of the at most two used spans to the start of
+ * the new buffer. On failure the ring buffer is left as it was.
+ */
+static int ringbuf_resize( ringbuf_t *rb, size_t capacity )
+{
+	uint8_t *old_buf = rb->buf;
+	size_t old_capacity = rb->capacity, old_mask = rb->mask, old_map_size = rb->map_size;
+	int old_flags = rb->flags;
+	size_t front = atomic_load_explicit( &rb->ctl->front, memory_order_relaxed );
+	size_t used = ringbuf_bytes_used( rb );
+	ringbuf_span_t span[ 2 ];
+
+	if ( rb->flags & ( RINGBUF_USER_STORAGE | RINGBUF_SHARED ) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	ringbuf_spans( rb, front, used, span );
+	rb->flags &= ~RINGBUF_MAPPED;
+	if ( ringbuf_setup_buf( rb, capacity > used ? capacity : used ) != 0 )
+	{
+		int err = errno;
+		rb->buf = old_buf;
+		rb->capacity = old_capacity;
+		rb->mask = old_mask;
+		rb->map_size = old_map_size;
+		rb->flags = old_flags;
+		errno = err;
+		return -1;
+	}
+
+	memcpy( rb->buf, span[ 0 ].data, span[ 0 ].len );
+	memcpy( rb->buf + span[ 0 ].len, span[ 1 ].data, span[ 1 ].len );
+	ringbuf_free_mem( rb, old_buf, old_map_size, old_flags );
+
+	atomic_store_explicit( &rb->ctl->front, 0, memory_order_relaxed );
+	atomic_store_explicit( &rb->ctl->back, used, memory_order_relaxed );
+	rb->ctl->front_cache = 0;
+	rb->ctl->back_cache = used;
+	if ( rb->stats )
+		rb->stats->bin_scale = ( double )RINGBUF_STATS_BINS / ( ringbuf_capacity( rb ) + 1 );
+	return 0;
+}
+
+RINGBUF_API int ringbuf_reserve( ringbuf_t *rb, size_t capacity )
+{
+	if ( capacity <= ringbuf_capacity( rb ) )
+		return 0;
+	return ringbuf_resize( rb, capacity );
+}
+
+/*
+ * The number of bytes ringbuf_setup_buf would allocate or map (its
+ * map_size) for a usable capacity of capacity bytes with rb's flags,
+ * following the rounding in ringbuf_setup_buf and ringbuf_alloc_buf. A
+ * mirrored ring buffer asking for huge pages is rounded the way rb
+ * itself was, since that tells whether huge pages were to be had.
+ */
+static size_t ringbuf_buf_size( const ringbuf_t *rb, size_t capacity )
+{
+	size_t size = capacity + 1;
+	if ( rb->flags & RINGBUF_POW2 )
+		size = ringbuf_pow2_ceil( capacity );
+
+#ifdef __linux__
+	size_t page = ( size_t )sysconf( _SC_PAGESIZE );
+	if ( rb->flags & RINGBUF_MIRRORED )
+	{
+		if ( ( rb->flags & RINGBUF_HUGEPAGES ) && rb->capacity % RINGBUF_HUGEPAGE_SIZE == 0 )
+			page = RINGBUF_HUGEPAGE_SIZE;
+		return 2 * ringbuf_round_up( size, page );
+	}
+	if ( ( rb->flags & RINGBUF_HUGEPAGES ) && rb->alloc.alloc == ringbuf_default_alloc )
+		return ringbuf_round_up( size, RINGBUF_HUGEPAGE_SIZE );
+#endif
+	return size;
+}
+
+RINGBUF_API int ringbuf_shrink_to_fit( ringbuf_t *rb )
+{
+	size_t used = ringbuf_bytes_used( rb );
+	size_t capacity = used ? used : 1;
+
+	/* don't reallocate for nothing */
+	if ( ringbuf_buf_size( rb, capacity ) >= rb->map_size )
+		return 0;
+	return ringbuf_resize( rb, capacity );
+}
+
+/*
+ * Records. Each record is a size_t header holding its length, followed
+ * by the payload, padded to a multiple of RINGBUF_RECORD_ALIGN. A
+ * record that would straddle the end of the buffer starts at the
+ * beginning instead: the producer fills the rest of the buffer with
+ * padding, marked by a header of RINGBUF_RECORD_PAD, or left unmarked
+ * if it is too short to hold a header. Both sides work out the same
+ * padding from the index alone, so it costs no extra bookkeeping. A
+ * mirrored ring buffer never needs padding.
+ */
+#define RINGBUF_RECORD_ALIGN sizeof( size_t )
+#define RINGBUF_RECORD_PAD SIZE_MAX
+
+/* Bytes from index i to the end of the buffer, where records wrap */
+static size_t ringbuf_record_room( const ringbuf_t *rb, size_t i )
+{
+	if ( rb->flags & RINGBUF_MIRRORED )
+		return SIZE_MAX;
+	return ( size_t )( rb->buf + rb->capacity - ringbuf_at( rb, i ) );
+}
+
+/*
+ * The largest record, header included. The padding in front of a
+ * record is always shorter than the record, so a record of up to half
+ * the capacity fits into an empty ring buffer wherever its indices
+ * are; a larger one might never fit.
+ */
+static size_t ringbuf_record_max( const ringbuf_t *rb )
+{
+	if ( rb->flags & RINGBUF_MIRRORED )
+		return ringbuf_capacity( rb );
+	return ringbuf_capacity( rb ) / 2;
+}
+
+/*
+ * Work out where a record of len bytes goes when written at index
+ * back: the padding in front of it, and the space it takes including
+ * its header (0 if it is too large).
+ */
+static size_t ringbuf_record_layout( const ringbuf_t *rb, size_t back, size_t len, size_t *pad )
+{
+	size_t size = RINGBUF_RECORD_ALIGN + ringbuf_round_up( len, RINGBUF_RECORD_ALIGN );
+	size_t room = ringbuf_record_room( rb, back );
+	if ( len > ringbuf_record_max( rb ) || size > ringbuf_record_max( rb ) )
+		return 0;
+	*pad = size <= room ? 0 : room;
+	return size;
+}
+
+/*
+ * Look at the record at index front, given used bytes after it.
+ * Returns the number of bytes up to the end of the record, including
+ * any padding in front of it, and describes its payload in rec; or 0
+ * if there is no record.
+ */
+static size_t ringbuf_record_next( const ringbuf_t *rb, size_t front, size_t used, ringbuf_span_t *rec )
+{
+	size_t skip = 0, len = 0;
+	size_t room = ringbuf_record_room( rb, front );
+
+	if ( used == 0 )
+		return 0;
+	if ( room >= RINGBUF_RECORD_ALIGN )
+		memcpy( &len, ringbuf_at( rb, front ), sizeof( len ) );
+	if ( room < RINGBUF_RECORD_ALIGN || len == RINGBUF_RECORD_PAD )
+	{
+		/* padding is only published together with the record after it */
+		assert( used > room );
+		skip = room;
+		front = ringbuf_advance( rb, front, room );
+		memcpy( &len, ringbuf_at( rb, front ), sizeof( len ) );
+	}
+
+	rec->data = ringbuf_at( rb, front ) + RINGBUF_RECORD_ALIGN;
+	rec->len = len;
+	return skip + RINGBUF_RECORD_ALIGN + ringbuf_round_up( len, RINGBUF_RECORD_ALIGN );
+}
+
+RINGBUF_API void *ringbuf_record_reserve( ringbuf_t *rb, size_t len )
+{
+	size_t back = atomic_load_explicit( &rb->ctl->back, memory_order_relaxed );
+	size_t pad, size = ringbuf_record_layout( rb, back, len, &pad );
+	if ( size == 0 || ringbuf_producer_free( rb, back, pad + size ) < pad + size )
+	{
+		if ( rb->stats )
+			ringbuf_stats_refused( &rb->stats->push_refusals );
+		return NULL;
+	}
+
+	if ( pad >= RINGBUF_RECORD_ALIGN )
+	{
+		size_t marker = RINGBUF_RECORD_PAD;
+		memcpy( ringbuf_at( rb, back ), &marker, sizeof( marker ) );
+	}
+	back = ringbuf_advance( rb, back, pad );
+	memcpy( ringbuf_at( rb, back ), &len, sizeof( len ) );
+	return ringbuf_at( rb, back ) + RINGBUF_RECORD_ALIGN;
+}
+
+RINGBUF_API void ringbuf_record_commit( ringbuf_t *rb, size_t len )
+{
+	size_t back = atomic_load_explicit( &rb->ctl->back, memory_order_relaxed );
+	size_t pad, size = ringbuf_record_layout( rb, back, len, &pad );
+	assert( size != 0 && pad + size <= ringbuf_producer_free( rb, back, pad + size ) );
+	ringbuf_publish_back( rb, ringbuf_advance( rb, back, pad + size ), 0, 0 );
+	ringbuf_stats_push( rb, pad + size, 0 );
+}
+
+RINGBUF_API int ringbuf_record_push( ringbuf_t *rb, const void *src, size_t len )
+{
+	void *rec = ringbuf_record_reserve( rb, len );
+	if ( !rec )
+		return 0;
+	memcpy( rec, src, len );
+	ringbuf_record_commit( rb, len );
+	return 1;
+}
+
+RINGBUF_API size_t ringbuf_record_peek_batch( ringbuf_t *rb, ringbuf_span_t *records, size_t max )
+{
+	size_t front = atomic_load_explicit( &rb->ctl->front, memory_order_relaxed );
+	size_t used = ringbuf_consumer_used( rb, front, SIZE_MAX );
+	size_t count = 0, n;
+
+	while ( count < max && ( n = ringbuf_record_next( rb, front, used, &records[ count ] ) ) != 0 )
+	{
+		front = ringbuf_advance( rb, front, n );
+		used -= n;
+		++count;
+	}
+	return count;
+}
+
+RINGBUF_API const void *ringbuf_record_peek( ringbuf_t *rb, size_t *len )
+{
+	ringbuf_span_t rec;
+	if ( ringbuf_record_peek_batch( rb, &rec, 1 ) == 0 )
+		return NULL;
+	*len = rec.len;
+	return rec.data;
+}
+
+RINGBUF_API void ringbuf_record_consume( ringbuf_t *rb, size_t count )
+{
+	size_t front = atomic_load_explicit( &rb->ctl->front, memory_order_relaxed );
+	size_t used = ringbuf_used( rb, front, rb->ctl->back_cache );
+	size_t total = 0, n;
+	ringbuf_span_t rec;
+
+	for ( ; count; --count )
+	{
+		n = ringbuf_record_next( rb, ringbuf_advance( rb, front, total ), used - total, &rec );
+		assert( n != 0 );
+		total += n;
+	}
+	ringbuf_publish_front( rb, ringbuf_advance( rb, front, total ) );
+	ringbuf_stats_pop( rb, total );
+}
+
+#ifdef RINGBUF_POSIX
+/* Describe the spans as an iovec array for readv/writev. */
+static int ringbuf_iovec( const ringbuf_span_t span[ 2 ], struct iovec iov[ 2 ] )
+{
+	int iovcnt = 0;
+	for ( int i = 0; i < 2; ++i )
+	{
+		if ( span[ i ].len )
+		{
+			iov[ iovcnt ].iov_base = span[ i ].data;
+			iov[ iovcnt ].iov_len = span[ i ].len;
+			++iovcnt;
+		}
+	}
+	return iovcnt;
+}
+
+RINGBUF_API ssize_t ringbuf_read_fd( ringbuf_t *rb, int fd, size_t max )
+{
+	ringbuf_span_t span[ 2 ];
+	struct iovec iov[ 2 ];
+	if ( ringbuf_write_reserve( rb, max, span ) == 0 )
+		return 0;
+
+	ssize_t n = readv( fd, iov, ringbuf_iovec( span, iov ) );
+	if ( n > 0 )
+		ringbuf_write_commit( rb, ( size_t )n );
+	return n;
+}
+
+RINGBUF_API ssize_t ringbuf_write_fd( ringbuf_t *rb, int fd, size_t max )
+{
+	ringbuf_span_t span[ 2 ];
+	struct iovec iov[ 2 ];
+	if ( ringbuf_read_peek( rb, max, span ) == 0 )
+		return 0;
+
+	ssize_t n = writev( fd, iov, ringbuf_iovec( span, iov ) );
+	if ( n > 0 )
+		ringbuf_read_consume( rb, ( size_t )n );
+	return n;
+}
+#endif
+
+/*
+ * Turn on the fence in ringbuf_notify before the first thread sleeps
+ * in ringbuf_wait. A push or pop already under way may have read the
+ * flag before it was set, so membarrier then makes every running
+ * thread (of any process, for a shared ring buffer) pass a full
+ * barrier: an index store before that barrier is visible to the
+ * waiter's recheck, and one after it sees the flag and fences. Returns
+ * -1 if membarrier failed, when the caller's first sleep must only be
+ * a nap, since a wakeup may have been missed.
+ */
+static int ringbuf_wait_enable( ringbuf_t *rb )
+{
+	if ( atomic_load_explicit( &rb->ctl->wait_enabled, memory_order_relaxed ) )
+		return 0;
+	atomic_store( &rb->ctl->wait_enabled, 1 );
+#ifdef __linux__
+	if ( syscall( SYS_membarrier, MEMBARRIER_CMD_GLOBAL, 0, 0 ) != 0 )
+		return -1;
+#endif
+	return 0;
+}
+
+/*
+ * Wait until avail(rb) >= n, for at most timeout milliseconds (forever
+ * if timeout is negative). The waiter publishes its threshold in want
+ * and sleeps on seq, which ringbuf_notify bumps before waking it.
+ * Reading seq before arming means a wakeup between the recheck and
+ * the futex call is never lost: the futex call then returns at once.
+ */
+static int ringbuf_wait( ringbuf_t *rb, atomic_size_t *want, atomic_uint *seq, size_t n, int timeout,
+	size_t ( *avail )( const ringbuf_t * ) )
+{
+	struct timespec deadline, left, nap = { 0, 1000000 };
+	if ( n > ringbuf_capacity( rb ) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ( timeout > 0 )
+	{
+		clock_gettime( CLOCK_MONOTONIC, &deadline );
+		deadline.tv_sec += timeout / 1000;
+		deadline.tv_nsec += ( timeout % 1000 ) * 1000000L;
+		if ( deadline.tv_nsec >= 1000000000L )
+		{
+			deadline.tv_sec += 1;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+
+	for ( ;; )
+	{
+		if ( avail( rb ) >= n )
+			return 0;
+
+		if ( timeout == 0 )
+			break;
+		if ( timeout > 0 )
+		{
+			clock_gettime( CLOCK_MONOTONIC, &left );
+			left.tv_sec = deadline.tv_sec - left.tv_sec;
+			left.tv_nsec = deadline.tv_nsec - left.tv_nsec;
+			if ( left.tv_nsec < 0 )
+			{
+				left.tv_sec -= 1;
+				left.tv_nsec += 1000000000L;
+			}
+			if ( left.tv_sec < 0 )
+				break;
+		}
+
+		const struct timespec *wait_for = timeout > 0 ? &left : NULL;
+		if ( ringbuf_wait_enable( rb ) != 0
+			&& ( !wait_for || wait_for->tv_sec > 0 || wait_for->tv_nsec > nap.tv_nsec ) )
+			wait_for = &nap;
+
+		unsigned val = atomic_load_explicit( seq, memory_order_acquire );
+		atomic_store_explicit( want, n, memory_order_relaxed );
+		atomic_thread_fence( memory_order_seq_cst );
+		if ( avail( rb ) < n )
+			ringbuf_futex_wait( rb, seq, val, wait_for );
+		atomic_store_explicit( want, 0, memory_order_relaxed );
+	}
+
+	errno = ETIMEDOUT;
+	return -1;
+}
+
+RINGBUF_API int ringbuf_wait_readable( ringbuf_t *rb, size_t n, int timeout )
+{
+	return ringbuf_wait( rb, &rb->ctl->read_want, &rb->ctl->read_seq, n, timeout, ringbuf_bytes_used );
+}
+
+RINGBUF_API int ringbuf_wait_writable( ringbuf_t *rb, size_t n, int timeout )
+{
+	return ringbuf_wait( rb, &rb->ctl->write_want, &rb->ctl->write_seq, n, timeout, ringbuf_bytes_free );
+}
+
+/*
+ * Attach (or re-mark) the eventfd in *fd, flagged by flag, and signal
+ * it at once if the watched space is already at mark or more.
+ */
+static int ringbuf_event( ringbuf_t *rb, int flag, int *fd, size_t *mark, size_t new_mark,
+	size_t ( *avail )( const ringbuf_t * ) )
+{
+	if ( new_mark == 0 || new_mark > ringbuf_capacity( rb ) || ( rb->flags & RINGBUF_SHARED ) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+#ifdef __linux__
+	if ( !( rb->flags & flag ) )
+	{
+		*fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+		if ( *fd < 0 )
+			return -1;
+		rb->flags |= flag;
+	}
+	*mark = new_mark;
+	ringbuf_event_edge( *fd, new_mark, 0, avail( rb ) );
+	return *fd;
+#else
+	( void )flag;
+	( void )fd;
+	( void )mark;
+	( void )avail;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+RINGBUF_API int ringbuf_event_readable( ringbuf_t *rb, size_t mark )
+{
+	return ringbuf_event( rb, RINGBUF_READ_EVENT, &rb->read_event, &rb->read_mark, mark, ringbuf_bytes_used );
+}
+
+RINGBUF_API int ringbuf_event_writable( ringbuf_t *rb, size_t mark )
+{
+	return ringbuf_event( rb, RINGBUF_WRITE_EVENT, &rb->write_event, &rb->write_mark, mark, ringbuf_bytes_free );
 }
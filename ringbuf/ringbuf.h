@@ -21,22 +21,421 @@
  * (e.g., with ringbuf_read). The ring buffer's tail pointer points to
  * the starting location where data should be read when copying data
  * *from* the buffer (e.g., with ringbuf_write).
+ *
+ * A ring buffer created with ringbuf_new_spsc may be shared by exactly
+ * two threads without any locking: one producer, which calls
+ * ringbuf_push_back and ringbuf_memset (and ringbuf_copy with the ring
+ * as dst), and one consumer, which calls ringbuf_pop_front (and
+ * ringbuf_copy with the ring as src). The front and back indices are
+ * published with release/acquire ordering, so data written before a
+ * push is visible to the consumer once the pop that sees it returns.
+ * The size queries may be called from either thread and return a
+ * consistent, if possibly stale, value. ringbuf_reset and
+ * ringbuf_free are never thread safe.
  */
 
+/* The header-only version needs ringbuf.c's feature macro up front */
+#if defined( RINGBUF_IMPLEMENTATION ) && !defined( _GNU_SOURCE )
+#define _GNU_SOURCE
+#endif
+
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/types.h>
 
+#ifndef __cplusplus
+#include <stdalign.h>
+#include <stdatomic.h>
+#endif
+
+#include "ringbuf_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Every function is declared RINGBUF_API. When RINGBUF_STATIC is
+ * defined together with RINGBUF_IMPLEMENTATION, the header-only
+ * version makes them all static inline, so the compiler is free to
+ * inline the push/pop paths into their callers (and several
+ * translation units may each include their own copy).
+ */
+#if defined( RINGBUF_IMPLEMENTATION ) && defined( RINGBUF_STATIC )
+#define RINGBUF_API static inline
+#else
+#define RINGBUF_API
+#endif
+
 typedef struct ringbuf_t ringbuf_t;
 
+/*
+ * A contiguous region of a ring buffer's internal buffer, as returned
+ * by ringbuf_write_reserve and ringbuf_read_peek.
+ */
+typedef struct ringbuf_span_t
+{
+	void *data;
+	size_t len;
+} ringbuf_span_t;
+
+/* Number of occupancy histogram bins in ringbuf_stats_t */
+#define RINGBUF_STATS_BINS 16
+
+/*
+ * A snapshot of a ring buffer's statistics, see ringbuf_stats_enable.
+ */
+typedef struct ringbuf_stats_t
+{
+	size_t capacity;         /* usable capacity of the ring buffer */
+	size_t bytes_used;       /* occupancy when the snapshot was taken */
+	uint64_t bytes_in;       /* bytes pushed, memset, copied or committed */
+	uint64_t bytes_out;      /* bytes popped, copied out or consumed */
+	uint64_t overflows;      /* pushes that overwrote old data */
+	uint64_t bytes_lost;     /* bytes overwritten by those pushes */
+	uint64_t push_refusals;  /* SPSC pushes refused for lack of room */
+	uint64_t pop_refusals;   /* pops refused for lack of data */
+	size_t high_water;       /* highest occupancy after a push */
+	size_t low_water;        /* lowest occupancy after a pop (or capacity) */
+
+	/*
+	 * Occupancy after each pop: bin i counts pops that left between
+	 * i/RINGBUF_STATS_BINS and (i+1)/RINGBUF_STATS_BINS of the
+	 * capacity in the buffer. Bin 0 filling up means the consumer is
+	 * running close to dry.
+	 */
+	uint64_t histogram[ RINGBUF_STATS_BINS ];
+} ringbuf_stats_t;
+
+/* Ring buffer mode flags */
+#define RINGBUF_SPSC 0x01
+#define RINGBUF_MIRRORED 0x02
+#define RINGBUF_POW2 0x04
+#define RINGBUF_GROW 0x100
+
+/* Memory flags for ringbuf_new_ex */
+#define RINGBUF_ALIGN_CACHELINE 0x08
+#define RINGBUF_ALIGN_PAGE 0x10
+#define RINGBUF_HUGEPAGES 0x20
+#define RINGBUF_PREFAULT 0x40
+#define RINGBUF_MLOCK 0x80
+
+/*
+ * Memory allocator hooks for ringbuf_new_ex. alloc returns size bytes
+ * aligned to at least align (0 meaning malloc's alignment), or 0 on
+ * failure; free receives the pointer and the size that was asked for.
+ * ctx is passed to both.
+ */
+typedef struct ringbuf_allocator_t
+{
+	void *( *alloc )( size_t size, size_t align, void *ctx );
+	void ( *free )( void *ptr, size_t size, void *ctx );
+	void *ctx;
+} ringbuf_allocator_t;
+
+/* Internal flag: buf is caller-owned and never freed by ringbuf_free */
+#define RINGBUF_USER_STORAGE 0x20000
+
+/*
+ * The struct is setup such that back always points to a position just
+ * after where data is stored. Additionally, the buffer size holds one
+ * extra byte as a sentinel value so that the empty and full conditions can be
+ * distinguished.
+ *
+ * front and back are offsets into buf. The consumer is the
+ * only writer of front and the producer is the only writer of back
+ * (except when an overflow in non-SPSC mode drags front along), so
+ * each lives on its own cache line together with a cached copy of the
+ * other side's index. The cached copies let the producer and consumer
+ * run without touching each other's cache line until they appear to
+ * have run out of room or data.
+ *
+ * A power-of-two ring buffer (RINGBUF_POW2) has no sentinel byte;
+ * instead front and back are counters that only ever grow, the buffer offset
+ * is the counter masked with capacity - 1, and the number of used
+ * bytes is simply back - front (unsigned wrap-around included).
+ * Every other ring buffer has a mask of all ones, so that masking is
+ * a no-op and the code below can always mask an index before using it.
+ *
+ * The wait state is on a third cache line that is only written when a
+ * thread goes to sleep in ringbuf_wait_readable/writable. read_want
+ * and write_want are the thresholds the sleeping consumer or producer
+ * is waiting for (0 when nobody waits), read_seq and write_seq are
+ * the futex words they sleep on, and wait_enabled is set by the first
+ * thread to sleep, so that pushes and pops only pay for waking anyone
+ * once there is somebody to wake.
+ *
+ * Those three cache lines make up struct ringbuf_ctl, which ctl points
+ * to: the ring buffer's own local_ctl, or for a shared memory ring
+ * buffer (ringbuf_new_shm) the copy in the shared mapping, which both
+ * processes update with atomics. Everything else is private to the
+ * process.
+ *
+ * read_event and write_event are the eventfds signalled when the used
+ * or free space rises to read_mark or write_mark; they are only valid
+ * when the ring buffer's internal event flags are set, so that a
+ * zero-initialised ring buffer has none.
+ *
+ * map_size is the number of bytes allocated or mapped for buf, which
+ * may be more than capacity, and alloc the allocator that the
+ * struct, buf (unless it was mapped) and stats were allocated with.
+ * stats is NULL unless ringbuf_stats_enable was called.
+ *
+ * The struct is only defined here so that a ring buffer can live in
+ * static or caller-owned memory (see ringbuf_init and RINGBUF_DECLARE);
+ * its fields are private to the ringbuf_* functions. C11 atomics do
+ * not compile as C++, so to C++ ringbuf_t stays opaque and only the
+ * functions that take a pointer to it are available.
+ */
+#ifndef __cplusplus
+struct ringbuf_stats_state;
+
+struct ringbuf_ctl
+{
+	/* Consumer state */
+	alignas( RINGBUF_CACHELINE ) atomic_size_t front;
+	size_t back_cache;
+
+	/* Producer state */
+	alignas( RINGBUF_CACHELINE ) atomic_size_t back;
+	size_t front_cache;
+
+	/* Wait state */
+	alignas( RINGBUF_CACHELINE ) atomic_size_t read_want;
+	atomic_size_t write_want;
+	atomic_uint read_seq;
+	atomic_uint write_seq;
+	atomic_uint wait_enabled;
+};
+
+struct ringbuf_t
+{
+	uint8_t *buf;
+	size_t capacity;
+	size_t mask;
+	int flags;
+	size_t map_size;
+	ringbuf_allocator_t alloc;
+	struct ringbuf_stats_state *stats;
+	struct ringbuf_ctl *ctl;
+	int read_event;
+	int write_event;
+	size_t read_mark;
+	size_t write_mark;
+	struct ringbuf_ctl local_ctl;
+};
+#endif
+
 /*
  * Create a new ring buffer with the given capacity (usable
  * bytes). Note that the actual internal buffer size may be one or
  * more bytes larger than the usable capacity, for bookkeeping.
  *
  * Returns the new ring buffer object, or 0 if there's not enough
- * memory to fulfill the request for the given capacity.
+ * memory to fulfill the request for the given capacity (or errno set to
+ * EINVAL if the capacity is more than a quarter of the address space).
+ */
+RINGBUF_API ringbuf_t *ringbuf_new( size_t capacity );
+
+/*
+ * Create a new ring buffer for single-producer/single-consumer use
+ * (see above). An SPSC ring buffer never overflows: a push that does
+ * not fit in the free space copies nothing, exactly as a pop that
+ * would underflow copies nothing, since overwriting the oldest data
+ * would mean the producer moving the consumer's front pointer.
+ */
+RINGBUF_API ringbuf_t *ringbuf_new_spsc( size_t capacity );
+
+/*
+ * Create a new ring buffer whose internal buffer is mapped twice,
+ * back to back, in virtual memory (Linux only). Any span of up to
+ * ringbuf_buffer_capacity bytes starting inside the buffer is then
+ * addressable as one contiguous block: the bytes_used bytes at
+ * ringbuf_front and the bytes_free bytes at ringbuf_back can be handed
+ * directly to code that expects a linear buffer, and the copy
+ * functions never split a memcpy at the wrap point.
+ *
+ * The internal buffer is rounded up to a whole number of pages, so
+ * the usable capacity may be larger than requested. flags may include
+ * RINGBUF_SPSC.
+ *
+ * Returns 0 if the mapping cannot be created, or on platforms without
+ * memfd support.
+ */
+RINGBUF_API ringbuf_t *ringbuf_new_mirrored( size_t capacity, int flags );
+
+/*
+ * Create a new ring buffer whose capacity is rounded up to a power of
+ * two. The whole internal buffer is usable (there is no sentinel
+ * byte), the front and back indices only ever grow and are masked
+ * into the buffer, and the size queries are a single subtraction, so
+ * the push/pop paths contain no division and no pointer comparisons.
+ *
+ * flags may include RINGBUF_SPSC and RINGBUF_MIRRORED; passing
+ * RINGBUF_POW2 to ringbuf_new_mirrored has the same effect.
+ */
+RINGBUF_API ringbuf_t *ringbuf_new_pow2( size_t capacity, int flags );
+
+/*
+ * Create a new ring buffer with full control over its memory. flags
+ * may combine the mode flags (RINGBUF_SPSC, RINGBUF_MIRRORED,
+ * RINGBUF_POW2, RINGBUF_GROW) with:
+ *
+ *   RINGBUF_ALIGN_CACHELINE, RINGBUF_ALIGN_PAGE
+ *       align the internal buffer to a cache line or a page.
+ *   RINGBUF_HUGEPAGES
+ *       back the internal buffer with huge pages (Linux), rounding it
+ *       up to a whole number of them. Reserved huge pages are tried
+ *       first, then transparent huge pages, then (for a mirrored ring
+ *       buffer) normal pages. With a custom allocator this only asks
+ *       the allocator for huge page alignment.
+ *   RINGBUF_PREFAULT
+ *       touch every page of the internal buffer up front.
+ *   RINGBUF_MLOCK
+ *       prefault and lock the internal buffer into RAM. If the lock
+ *       fails (e.g. because of RLIMIT_MEMLOCK) no ring buffer is
+ *       created and errno is set by mlock.
+ *
+ * allocator, if not 0, is used for the ring buffer itself, for its
+ * statistics and, unless it is mirrored or mapped with huge pages, for
+ * its internal buffer. The allocator is copied, but ctx must stay
+ * valid until ringbuf_free.
+ *
+ * Returns the new ring buffer object, or 0 on failure (with errno set
+ * to EINVAL for unknown flags, or RINGBUF_GROW with RINGBUF_SPSC).
  */
-ringbuf_t *ringbuf_new( size_t capacity );
+RINGBUF_API ringbuf_t *ringbuf_new_ex( size_t capacity, int flags, const ringbuf_allocator_t *allocator );
+
+/*
+ * Initialise a ring buffer over caller-owned storage of size bytes,
+ * without allocating anything: rb and storage may be static, on the
+ * stack or carved out of a larger block, and must outlive the ring
+ * buffer. flags may include RINGBUF_SPSC and RINGBUF_POW2; with
+ * RINGBUF_POW2 size must be a power of two and all of it is usable,
+ * otherwise one byte of it is the sentinel.
+ *
+ * ringbuf_free may, but need not, be called on such a ring buffer; it
+ * releases only the statistics, if they were enabled.
+ *
+ * Returns 0, or -1 with errno set to EINVAL if size is less than 2,
+ * not a power of two when RINGBUF_POW2 is given, or flags asks for
+ * anything else.
+ */
+RINGBUF_API int ringbuf_init( ringbuf_t *rb, void *storage, size_t size, int flags );
+
+/*
+ * Create an SPSC ring buffer in shared memory, so that the producer
+ * and the consumer can be in different processes. fd is an open file
+ * descriptor from shm_open or memfd_create, which is resized to hold
+ * a one page header (the indices, capacity and layout version) and a
+ * power-of-two buffer of at least capacity bytes and one page. flags
+ * may be RINGBUF_MIRRORED, which maps the buffer twice as for
+ * ringbuf_new_mirrored.
+ *
+ * The other process opens the same object (or receives fd, e.g. over
+ * a Unix socket or across fork) and calls ringbuf_attach_shm once
+ * ringbuf_new_shm has returned. Either side may be the producer. From
+ * then on data moves through the shared mapping with the usual
+ * functions; ringbuf_write_reserve and ringbuf_read_peek reach it
+ * without any copy, and there are no system calls unless a side sleeps
+ * in ringbuf_wait_readable/writable, which work across processes.
+ *
+ * Each handle has its own statistics. Eventfds cannot be attached
+ * and the ring buffer cannot be resized. fd may be closed once the
+ * handle exists; ringbuf_free unmaps the handle's view, and the memory
+ * goes away when the object is unlinked (or its last fd closed) and
+ * the last view unmapped.
+ *
+ * Returns the new ring buffer object, or 0 with errno set to EINVAL
+ * if capacity is 0 or flags asks for anything else, ENOSYS without
+ * mmap, or by ftruncate or mmap.
+ */
+RINGBUF_API ringbuf_t *ringbuf_new_shm( int fd, size_t capacity, int flags );
+
+/*
+ * Attach to a shared memory ring buffer created by ringbuf_new_shm.
+ *
+ * Returns a new ring buffer object for this process, or 0 with errno
+ * set to EINVAL if fd does not hold a ring buffer of this version or
+ * its indices are out of range, ENOSYS without mmap, or by fstat,
+ * read or mmap.
+ */
+RINGBUF_API ringbuf_t *ringbuf_attach_shm( int fd );
+
+/*
+ * Open a ring buffer kept in the file at path, for capture that has to
+ * survive a crash. The file holds the same header and buffer as a
+ * shared memory ring buffer and is mapped, so a push or pop is just a
+ * store to the page cache, and the kernel writes the pages back in its
+ * own time.
+ *
+ * If the file is empty (or new) it is set up with at least capacity
+ * bytes, as for ringbuf_new_shm. Otherwise the file must already hold
+ * a ring buffer, which is recovered as it was left: the capacity and
+ * flags stored in the file are used, and the arguments are ignored.
+ *
+ * flags may include RINGBUF_MIRRORED and RINGBUF_SPSC. Without
+ * RINGBUF_SPSC a push that does not fit overwrites the oldest data, so
+ * the file always holds the most recent capacity bytes; as for any
+ * such ring buffer, pushes and pops must then not run concurrently.
+ * Another process may use ringbuf_attach_shm on the open file.
+ *
+ * A crash of the process loses nothing, since the page cache outlives
+ * it. Only data that ringbuf_sync has written is safe from a power
+ * failure or a kernel crash. Recovering a file resets the cached
+ * indices and any wait state left in it, so it must not be reopened
+ * while another process is using it. A push that overwrites the oldest data drops it before
+ * writing over it, so a crash in the middle of a push never leaves
+ * half-overwritten data in the file.
+ *
+ * Returns the new ring buffer object, or 0 with errno set to EINVAL
+ * if flags asks for anything else, capacity is 0 for a new file, or
+ * the file holds something other than an intact ring buffer, ENOSYS
+ * without mmap, or by open, ftruncate or mmap. A file created by the
+ * call is removed again when it fails.
+ */
+RINGBUF_API ringbuf_t *ringbuf_open_file( const char *path, size_t capacity, int flags );
+
+/*
+ * Write a file-backed (or shared memory) ring buffer's data and then
+ * its header back to the file, and wait for both to reach the disk.
+ * Once it returns, the data and indices as of the call are on disk.
+ * Between calls the kernel writes pages back in any order, so after a
+ * power failure the recovered indices may not match the data written
+ * since the last call. Does nothing for any other ring buffer.
+ * Either thread may call it; it blocks only the caller.
+ *
+ * Returns 0, or -1 with errno set by msync.
+ */
+RINGBUF_API int ringbuf_sync( ringbuf_t *rb );
+
+/*
+ * Resize a ring buffer in place, keeping its contents in FIFO order:
+ * the used bytes are copied once, to the start of a new internal
+ * buffer set up with the ring buffer's flags, and the old one is
+ * freed. ringbuf_reserve grows the usable capacity to at least
+ * capacity (and does nothing if it is already that large), and
+ * ringbuf_shrink_to_fit shrinks it to about ringbuf_bytes_used. The
+ * rounding of power-of-two and mirrored ring buffers still applies.
+ *
+ * A ring buffer created with RINGBUF_GROW grows itself, to twice its
+ * capacity or to what is needed if that is more, whenever a push,
+ * memset or copy into it would otherwise overflow; it never
+ * overwrites old data. If growing fails, nothing is written and the
+ * push fails as it would on a full SPSC ring buffer.
+ *
+ * Like ringbuf_reset, these are not thread safe, so RINGBUF_GROW
+ * cannot be combined with RINGBUF_SPSC. Pointers and spans into the
+ * old buffer become invalid.
+ *
+ * Returns 0, or -1 with errno set if the new buffer cannot be
+ * allocated (or to EINVAL for a ring buffer over caller-owned
+ * storage), in which case the ring buffer is unchanged.
+ */
+RINGBUF_API int ringbuf_reserve( ringbuf_t *rb, size_t capacity );
+
+RINGBUF_API int ringbuf_shrink_to_fit( ringbuf_t *rb );
 
 /*
  * The capacity of the internal buffer, in bytes.
@@ -44,48 +443,51 @@ ringbuf_t *ringbuf_new( size_t capacity );
  * For the usable capacity of the ring buffer, use the
  * ringbuf_capacity function.
  */
-size_t ringbuf_buffer_capacity( const ringbuf_t *rb );
+RINGBUF_API size_t ringbuf_buffer_capacity( const ringbuf_t *rb );
 
 /*
  * Deallocate a ring buffer, and, as a side effect, set the pointer to
- * 0.
+ * 0. For a ring buffer set up with ringbuf_init or RINGBUF_DECLARE,
+ * the storage is left alone.
  */
-void ringbuf_free( ringbuf_t *rb );
+RINGBUF_API void ringbuf_free( ringbuf_t *rb );
 
 /*
  * Reset a ring buffer to its initial state (empty).
  */
-void ringbuf_reset( ringbuf_t *rb );
+RINGBUF_API void ringbuf_reset( ringbuf_t *rb );
 
 /*
  * The usable capacity of the ring buffer, in bytes. Note that this
  * value may be less than the ring buffer's internal buffer size, as
  * returned by ringbuf_buffer_size.
  */
-size_t ringbuf_capacity( const ringbuf_t *rb );
+RINGBUF_API size_t ringbuf_capacity( const ringbuf_t *rb );
 
 /*
  * The number of free/available bytes in the ring buffer. This value
  * is never larger than the ring buffer's usable capacity.
  */
-size_t ringbuf_bytes_free( const ringbuf_t *rb );
+RINGBUF_API size_t ringbuf_bytes_free( const ringbuf_t *rb );
 
 /*
  * The number of bytes currently being used in the ring buffer. This
  * value is never larger than the ring buffer's usable capacity.
  */
-size_t ringbuf_bytes_used( const ringbuf_t *rb );
+RINGBUF_API size_t ringbuf_bytes_used( const ringbuf_t *rb );
 
-int ringbuf_is_full( const ringbuf_t *rb );
+RINGBUF_API int ringbuf_is_full( const ringbuf_t *rb );
 
-int ringbuf_is_empty( const ringbuf_t *rb );
+RINGBUF_API int ringbuf_is_empty( const ringbuf_t *rb );
 
 /*
- * Const access to the head and tail pointers of the ring buffer.
+ * Const access to the head and tail pointers of the ring buffer. For
+ * a mirrored ring buffer, the used bytes starting at the front pointer
+ * and the free bytes starting at the back pointer are contiguous.
  */
-const void *ringbuf_front( const ringbuf_t *rb );
+RINGBUF_API const void *ringbuf_front( const ringbuf_t *rb );
 
-const void *ringbuf_back( const ringbuf_t *rb );
+RINGBUF_API const void *ringbuf_back( const ringbuf_t *rb );
 
 
 /*
@@ -105,9 +507,11 @@ const void *ringbuf_back( const ringbuf_t *rb );
  * may be different than it was before the function was called.
  *
  * Returns the actual number of bytes written to dst: len, if
- * len < ringbuf_buffer_size(dst), else ringbuf_buffer_size(dst).
+ * len < ringbuf_buffer_size(dst), else ringbuf_buffer_size(dst). An
+ * SPSC ring buffer is never overflowed; if len is greater than the
+ * number of free bytes nothing is written and 0 is returned.
  */
-size_t ringbuf_memset( ringbuf_t *rb, int c, size_t len );
+RINGBUF_API size_t ringbuf_memset( ringbuf_t *rb, int c, size_t len );
 
 /*
  * Copy n bytes from a contiguous memory area src into the ring buffer
@@ -121,9 +525,12 @@ size_t ringbuf_memset( ringbuf_t *rb, int c, size_t len );
  * needed. However, note that, if calling the function results in an
  * overflow, the value of the ring buffer's front pointer may be
  * different than it was before the function was called.
+ *
+ * An SPSC ring buffer is never overflowed; if count is greater than
+ * the number of free bytes, no bytes are copied and NULL is returned.
  */
 
-void *ringbuf_push_back( ringbuf_t *rb, const void *src, size_t count );
+RINGBUF_API void *ringbuf_push_back( ringbuf_t *rb, const void *src, size_t count );
 
 /*
  * Copy n bytes from the ring buffer src, starting from its front
@@ -140,7 +547,7 @@ void *ringbuf_push_back( ringbuf_t *rb, const void *src, size_t count );
  * count is greater than the number of bytes used in the ring buffer,
  * no bytes are copied, and the function will return NULL.
  */
-void *ringbuf_pop_front( void *out, ringbuf_t *rb, size_t count );
+RINGBUF_API void *ringbuf_pop_front( void *out, ringbuf_t *rb, size_t count );
 
 /*
  * Copy count bytes from ring buffer src, starting from its tail
@@ -163,9 +570,311 @@ void *ringbuf_pop_front( void *out, ringbuf_t *rb, size_t count );
  *
  * It is *not* possible to underflow src; if count is greater than the
  * number of bytes used in src, no bytes are copied, and the function
- * returns 0.
+ * returns 0. Likewise, if dst is an SPSC ring buffer without room for
+ * count bytes, nothing is copied and 0 is returned.
+ */
+RINGBUF_API void *ringbuf_copy( ringbuf_t *dst, ringbuf_t *src, size_t count );
+
+/*
+ * Like ringbuf_copy, but non-destructive with respect to src: the
+ * count bytes starting offset bytes past src's front pointer are
+ * copied into dst and stay in src. Returns dst's new head pointer, or
+ * 0 if src holds fewer than offset + count bytes or if dst is an SPSC
+ * ring buffer without room for count bytes; nothing is copied then.
+ */
+RINGBUF_API void *ringbuf_copy_at( ringbuf_t *dst, ringbuf_t *src, size_t offset, size_t count );
+
+/*
+ * Lookahead for parsers. ringbuf_peek_at copies count bytes starting
+ * offset bytes past the front pointer into dst without consuming
+ * them, and returns count, or 0 (copying nothing) if fewer than
+ * offset + count bytes are used. ringbuf_skip drops up to count bytes
+ * from the front without copying them and returns how many it
+ * dropped. Both are consumer-side functions.
+ */
+RINGBUF_API size_t ringbuf_peek_at( ringbuf_t *rb, size_t offset, void *dst, size_t count );
+
+RINGBUF_API size_t ringbuf_skip( ringbuf_t *rb, size_t count );
+
+/*
+ * Framing helpers. ringbuf_find_byte searches the used bytes from
+ * offset bytes past the front pointer onwards for the byte c, and
+ * ringbuf_find_pattern for the len bytes at pattern. The search runs
+ * in place, with memchr and memmem over the (at most two) contiguous
+ * spans, plus a check of the matches that straddle the wrap point, so
+ * it goes as fast as the C library's vectorised scanning.
+ *
+ * Both return the offset of the first match from the front pointer,
+ * so a frame that ends with a match at offset n is popped with
+ * ringbuf_pop_front( dst, rb, n + len ). If there is no match they
+ * return the offset at which to resume the search once more data has
+ * arrived: the number of used bytes for ringbuf_find_byte, and for
+ * ringbuf_find_pattern the start of the last len - 1 bytes, which
+ * might begin a match. Both are consumer-side functions.
+ */
+RINGBUF_API size_t ringbuf_find_byte( ringbuf_t *rb, int c, size_t offset );
+
+RINGBUF_API size_t ringbuf_find_pattern( ringbuf_t *rb, const void *pattern, size_t len, size_t offset );
+
+/*
+ * Zero-copy access to the ring buffer. Rather than copying through a
+ * caller supplied buffer, these functions hand out the internal
+ * buffer itself as (at most) two spans, split at the point where the
+ * ring wraps around; the second span is empty when no wrap is needed,
+ * and always empty for a mirrored ring buffer.
+ *
+ * ringbuf_write_reserve describes up to count free bytes starting at
+ * the back pointer and returns how many bytes the spans cover (never
+ * more than ringbuf_bytes_free). The caller fills any prefix of them
+ * and then calls ringbuf_write_commit with the number of bytes
+ * written, which makes them visible to the consumer. Reserving does not
+ * change the ring buffer, so a reservation may be abandoned by not
+ * committing it.
+ *
+ * ringbuf_read_peek describes up to count used bytes starting at the
+ * front pointer and returns how many bytes the spans cover (never more
+ * than ringbuf_bytes_used). ringbuf_read_consume then releases the
+ * given number of bytes from the front of the ring buffer.
+ *
+ * The write functions belong to the producer and the read functions
+ * to the consumer, so they may be used on an SPSC ring buffer from
+ * the two sides concurrently. Neither pair ever overflows or
+ * underflows the ring buffer; committing or consuming more than was
+ * reserved or peeked is an error.
+ */
+RINGBUF_API size_t ringbuf_write_reserve( ringbuf_t *rb, size_t count, ringbuf_span_t span[ 2 ] );
+
+RINGBUF_API void ringbuf_write_commit( ringbuf_t *rb, size_t count );
+
+RINGBUF_API size_t ringbuf_read_peek( ringbuf_t *rb, size_t count, ringbuf_span_t span[ 2 ] );
+
+RINGBUF_API void ringbuf_read_consume( ringbuf_t *rb, size_t count );
+
+/*
+ * Records: variable-length messages whose boundaries the ring buffer
+ * keeps, so neither side needs its own length prefixes. Every record
+ * is stored contiguously (a record that would straddle the wrap point
+ * is moved to the start of the buffer, and the gap is skipped by the
+ * consumer), and takes its length rounded up to a multiple of
+ * sizeof( size_t ) plus a size_t header. A ring buffer used for
+ * records must not also be used with the byte functions.
+ *
+ * ringbuf_record_push copies a whole record of len bytes into the
+ * ring buffer and returns 1, or writes nothing and returns 0 if there
+ * is not enough room; records are never overwritten, even outside of
+ * SPSC mode. A record, header included, may take up at most half the
+ * capacity (all of it, for a mirrored ring buffer); a larger one is
+ * always refused.
+ *
+ * ringbuf_record_reserve and ringbuf_record_commit do the same
+ * without the copy: reserve returns a contiguous area of len bytes to
+ * write the record into (or 0), and commit, with the same len, makes
+ * it visible to the consumer.
+ *
+ * ringbuf_record_peek returns a pointer to the oldest record and sets
+ * len to its length, or returns 0 if there is none.
+ * ringbuf_record_peek_batch describes up to max of the oldest records
+ * in records and returns how many it found. The records stay valid
+ * until ringbuf_record_consume releases the given number of them, all
+ * at once.
+ */
+RINGBUF_API int ringbuf_record_push( ringbuf_t *rb, const void *src, size_t len );
+
+RINGBUF_API void *ringbuf_record_reserve( ringbuf_t *rb, size_t len );
+
+RINGBUF_API void ringbuf_record_commit( ringbuf_t *rb, size_t len );
+
+RINGBUF_API const void *ringbuf_record_peek( ringbuf_t *rb, size_t *len );
+
+RINGBUF_API size_t ringbuf_record_peek_batch( ringbuf_t *rb, ringbuf_span_t *records, size_t max );
+
+RINGBUF_API void ringbuf_record_consume( ringbuf_t *rb, size_t count );
+
+/*
+ * Read up to max bytes from the file descriptor fd into the ring
+ * buffer, with a single readv call that fills both sides of the wrap
+ * point, so no intermediate buffer is needed. At most
+ * ringbuf_bytes_free bytes are read; the ring buffer is never
+ * overflowed. This is a producer-side function.
+ *
+ * Returns the number of bytes read, 0 if the ring buffer is full (or
+ * max is 0) or at end of file, or -1 with errno set by readv.
  */
-void *ringbuf_copy( ringbuf_t *dst, ringbuf_t *src, size_t count );
+RINGBUF_API ssize_t ringbuf_read_fd( ringbuf_t *rb, int fd, size_t max );
+
+/*
+ * Write up to max bytes from the front of the ring buffer to the file
+ * descriptor fd with a single writev call, and release the bytes that
+ * were written. This is a consumer-side function.
+ *
+ * Returns the number of bytes written, 0 if the ring buffer is empty
+ * (or max is 0), or -1 with errno set by writev.
+ */
+RINGBUF_API ssize_t ringbuf_write_fd( ringbuf_t *rb, int fd, size_t max );
+
+/*
+ * Block the calling thread until at least n bytes are used
+ * (ringbuf_wait_readable, called by the consumer) or free
+ * (ringbuf_wait_writable, called by the producer), or until timeout
+ * milliseconds have passed. A negative timeout waits forever and a
+ * timeout of 0 just checks.
+ *
+ * The waiting thread sleeps on a futex (Linux) and is woken by the
+ * push, pop, commit or consume on the other side that makes the
+ * threshold reachable, and not before. Until a thread first sleeps
+ * on the ring buffer, the other side pays nothing for this but a test
+ * of a flag; from then on, a memory fence per operation, but never a
+ * system call while nobody is waiting.
+ *
+ * Returns 0 once the condition holds, or -1 with errno set to
+ * ETIMEDOUT if the timeout expired, or EINVAL if n is larger than the
+ * capacity of the ring buffer. At most one thread may wait for each
+ * condition at a time.
+ */
+RINGBUF_API int ringbuf_wait_readable( ringbuf_t *rb, size_t n, int timeout );
+
+RINGBUF_API int ringbuf_wait_writable( ringbuf_t *rb, size_t n, int timeout );
+
+/*
+ * Readiness notification for event loops. ringbuf_event_readable
+ * returns an eventfd (Linux) that becomes readable whenever a push,
+ * memset, copy or commit raises the number of used bytes from below
+ * mark to mark or more, and ringbuf_event_writable one that does the
+ * same when a pop, copy or consume raises the number of free bytes to
+ * mark. The fd can be added to epoll, poll or select alongside sockets
+ * and files.
+ *
+ * Only the crossing edge is signalled, so there are no spurious
+ * wakeups: when the fd fires, read its 8 byte counter to rearm it and
+ * then keep popping (or pushing) until fewer than mark bytes are used
+ * (or free), or the next crossing may never come. If the level is
+ * already reached when the fd is attached, it is signalled at once.
+ *
+ * Calling either function again changes the mark and returns the same
+ * fd, which belongs to the ring buffer and is closed by ringbuf_free.
+ * Attach the fds before the ring buffer is shared with other threads.
+ * When no fd is attached, there is no cost beyond a test of the flags.
+ *
+ * Returns the fd, or -1 with errno set to EINVAL if mark is 0 or
+ * larger than the capacity, ENOSYS without eventfd support, or by
+ * eventfd.
+ */
+RINGBUF_API int ringbuf_event_readable( ringbuf_t *rb, size_t mark );
+
+RINGBUF_API int ringbuf_event_writable( ringbuf_t *rb, size_t mark );
+
+/*
+ * Start collecting statistics for the ring buffer: byte counts in and
+ * out, overflows and the bytes they overwrote, refused pushes and
+ * pops, high and low water marks and an occupancy histogram. Until
+ * this is called, the cost of statistics on every operation is a
+ * single test of a NULL pointer. Call it before the ring buffer is
+ * shared with other threads.
+ *
+ * Returns 0 on success, or -1 if there's not enough memory.
+ */
+RINGBUF_API int ringbuf_stats_enable( ringbuf_t *rb );
+
+/*
+ * Copy the statistics into out. This may be called from any thread
+ * (e.g. a monitoring thread) while the producer and consumer keep
+ * running; they are never blocked. Each counter is read atomically,
+ * but the counters are not read as one atomic snapshot, so e.g.
+ * bytes_in - bytes_out may differ slightly from bytes_used.
+ *
+ * Returns 0, or -1 if statistics were never enabled.
+ */
+RINGBUF_API int ringbuf_stats_snapshot( const ringbuf_t *rb, ringbuf_stats_t *out );
+
+#ifndef __cplusplus
+/*
+ * Static initialiser for an SPSC power-of-two ring buffer over the
+ * array storage of N bytes, equivalent to ringbuf_init( rb, storage,
+ * N, RINGBUF_SPSC | RINGBUF_POW2 ) but usable at file scope. The
+ * index state is a compound literal, which lives exactly as long as a
+ * ring buffer variable in the same scope.
+ */
+#define RINGBUF_INITIALIZER( storage, N )                                                                  \
+	{                                                                                                  \
+		.buf = ( storage ), .capacity = ( N ), .mask = ( N ) - 1,                                  \
+		.flags = RINGBUF_SPSC | RINGBUF_POW2 | RINGBUF_USER_STORAGE, .map_size = ( N ),            \
+		.ctl = &( struct ringbuf_ctl ){ 0 }                                                        \
+	}
+
+/*
+ * The push and pop fast paths of RINGBUF_DECLARE. buf and size are
+ * passed in as constants, so once these are inlined the wrap mask and
+ * the split point of the copy are folded at compile time. When the
+ * space or data is not there, they leave the refusal (and its
+ * statistics) to ringbuf_push_back and ringbuf_pop_front.
+ */
+static inline size_t ringbuf_static_push( ringbuf_t *rb, uint8_t *buf, size_t size, const void *src, size_t count )
+{
+	size_t back = atomic_load_explicit( &rb->ctl->back, memory_order_relaxed );
+	if ( size - ( back - rb->ctl->front_cache ) < count )
+	{
+		rb->ctl->front_cache = atomic_load_explicit( &rb->ctl->front, memory_order_acquire );
+		if ( size - ( back - rb->ctl->front_cache ) < count )
+			return ringbuf_push_back( rb, src, count ) ? count : 0;
+	}
+
+	size_t i = back & ( size - 1 );
+	size_t n = size - i < count ? size - i : count;
+	memcpy( buf + i, src, n );
+	memcpy( buf, ( const uint8_t * )src + n, count - n );
+	ringbuf_write_commit( rb, count );
+	return count;
+}
+
+static inline size_t ringbuf_static_pop( ringbuf_t *rb, const uint8_t *buf, size_t size, void *dst, size_t count )
+{
+	size_t front = atomic_load_explicit( &rb->ctl->front, memory_order_relaxed );
+	if ( rb->ctl->back_cache - front < count )
+	{
+		rb->ctl->back_cache = atomic_load_explicit( &rb->ctl->back, memory_order_acquire );
+		if ( rb->ctl->back_cache - front < count )
+			return ringbuf_pop_front( dst, rb, count ) ? count : 0;
+	}
+
+	size_t i = front & ( size - 1 );
+	size_t n = size - i < count ? size - i : count;
+	memcpy( dst, buf + i, n );
+	memcpy( ( uint8_t * )dst + n, buf, count - n );
+	ringbuf_read_consume( rb, count );
+	return count;
+}
+
+/*
+ * Define, at file scope, a statically allocated SPSC ring buffer
+ * called name with a capacity of N bytes, where N is a power of two
+ * known at compile time, together with
+ *
+ *   size_t name_push( const void *src, size_t count );
+ *   size_t name_pop( void *dst, size_t count );
+ *
+ * which behave as ringbuf_push_back and ringbuf_pop_front on &name
+ * (all or nothing, returning count or 0) but have the capacity and
+ * the buffer address built in. &name may be passed to every other
+ * ringbuf_* function. Everything the macro defines is static to the
+ * translation unit.
+ */
+#define RINGBUF_DECLARE( name, N )                                                                         \
+	_Static_assert( ( N ) >= 2 && ( ( N ) & ( ( N ) - 1 ) ) == 0, #name ": N must be a power of two" ); \
+	static alignas( RINGBUF_CACHELINE ) uint8_t name##_storage[ N ];                                   \
+	static ringbuf_t name = RINGBUF_INITIALIZER( name##_storage, N );                                  \
+	static inline size_t name##_push( const void *src, size_t count )                                  \
+	{                                                                                                  \
+		return ringbuf_static_push( &name, name##_storage, ( N ), src, count );                    \
+	}                                                                                                  \
+	static inline size_t name##_pop( void *dst, size_t count )                                         \
+	{                                                                                                  \
+		return ringbuf_static_pop( &name, name##_storage, ( N ), dst, count );                     \
+	}
+#endif
+
+#ifdef __cplusplus
+}
+#endif
 
 // Include the implementation for a "header only" version of the library
 #ifdef RINGBUF_IMPLEMENTATION
@@ -0,0 +1,50 @@
+#ifndef INCLUDED_RINGBUF_COMMON_H
+#define INCLUDED_RINGBUF_COMMON_H
+
+/*
+ * ringbuf_common.h - definitions shared by the ring buffer modules.
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Size of a cache line, used to keep producer and consumer state apart. */
+#ifndef RINGBUF_CACHELINE
+#define RINGBUF_CACHELINE 64
+#endif
+
+/*
+ * The smaller of two sizes. A function rather than a macro, so that an
+ * argument such as a call that refreshes a cached index is only
+ * evaluated once.
+ */
+static inline size_t ringbuf_min( size_t a, size_t b )
+{
+	return a < b ? a : b;
+}
+
+/* The larger of two sizes, see ringbuf_min. */
+static inline size_t ringbuf_max( size_t a, size_t b )
+{
+	return a > b ? a : b;
+}
+
+/*
+ * The smallest power of two that is at least n (and at least 1), or 0 if
+ * that does not fit in a size_t. Callers must check for 0 rather than
+ * rounding up in a loop of their own, which never ends for such an n.
+ */
+static inline size_t ringbuf_pow2_ceil( size_t n )
+{
+	size_t p = 1;
+
+	if ( n > SIZE_MAX / 2 + 1 )
+		return 0;
+	while ( p < n )
+		p <<= 1;
+	return p;
+}
+
+#endif /* INCLUDED_RINGBUF_COMMON_H */
@@ -0,0 +1,472 @@
+/*
+ * ringio.c - io_uring engine that fills and drains ring buffers.
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+/* syscall and MAP_POPULATE */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "ringio.h"
+#include "ringbuf_common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* Stream kinds, RINGIO_FREE for an unused slot */
+enum
+{
+	RINGIO_FREE,
+	RINGIO_READ,
+	RINGIO_WRITE,
+};
+
+/* What a stream has in flight, also the low bits of its user_data */
+enum
+{
+	RINGIO_IDLE,
+	RINGIO_IO,
+	RINGIO_POLL,
+};
+
+/* user_data of a cancellation, whose completion is ignored */
+#define RINGIO_CANCEL UINT64_MAX
+
+/*
+ * One stream. Only one operation is in flight at a time: the readv or
+ * writev (RINGIO_IO), which uses iov, or the poll of the ring buffer's
+ * event fd (RINGIO_POLL) when there was no batch to transfer.
+ */
+struct ringio_stream
+{
+	ringbuf_t *rb;
+	int fd;
+	int event;
+	int kind;
+	int busy;
+	int removed;
+	int status;
+	off_t offset;
+	size_t batch;
+	struct iovec iov[ 2 ];
+};
+
+/*
+ * The io_uring and its queues, as mapped from the kernel. sq_tail_local
+ * runs ahead of *sq_tail while entries are being filled in, and is
+ * published just before io_uring_enter. inflight counts the operations
+ * (cancellations included) that have been queued but not completed.
+ */
+struct ringio_t
+{
+	int ring_fd;
+	int max_streams;
+	unsigned inflight;
+	struct ringio_stream *streams;
+
+	/* Submission queue */
+	atomic_uint *sq_head;
+	atomic_uint *sq_tail;
+	unsigned sq_tail_local;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+
+	/* Completion queue */
+	atomic_uint *cq_head;
+	atomic_uint *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_map;
+	void *cq_map;
+	size_t sq_map_size;
+	size_t cq_map_size;
+	size_t sqes_size;
+};
+
+/* Map the queues of the io_uring set up with params p */
+static int ringio_map( ringio_t *io, const struct io_uring_params *p )
+{
+	io->sq_map_size = p->sq_off.array + p->sq_entries * sizeof( unsigned );
+	io->cq_map_size = p->cq_off.cqes + p->cq_entries * sizeof( struct io_uring_cqe );
+	if ( p->features & IORING_FEAT_SINGLE_MMAP )
+		io->sq_map_size = io->cq_map_size = ringbuf_max( io->sq_map_size, io->cq_map_size );
+
+	io->sq_map = mmap( NULL, io->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd,
+		IORING_OFF_SQ_RING );
+	if ( io->sq_map == MAP_FAILED )
+	{
+		io->sq_map = NULL;
+		return -1;
+	}
+	io->cq_map = io->sq_map;
+	if ( !( p->features & IORING_FEAT_SINGLE_MMAP ) )
+	{
+		io->cq_map = mmap( NULL, io->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd,
+			IORING_OFF_CQ_RING );
+		if ( io->cq_map == MAP_FAILED )
+		{
+			io->cq_map = NULL;
+			return -1;
+		}
+	}
+	io->sqes_size = p->sq_entries * sizeof( struct io_uring_sqe );
+	io->sqes = mmap( NULL, io->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd,
+		IORING_OFF_SQES );
+	if ( io->sqes == MAP_FAILED )
+	{
+		io->sqes = NULL;
+		return -1;
+	}
+
+	uint8_t *sq = io->sq_map, *cq = io->cq_map;
+	io->sq_head = ( atomic_uint * )( sq + p->sq_off.head );
+	io->sq_tail = ( atomic_uint * )( sq + p->sq_off.tail );
+	io->sq_mask = *( unsigned * )( sq + p->sq_off.ring_mask );
+	io->sq_entries = p->sq_entries;
+	io->sq_tail_local = atomic_load_explicit( io->sq_tail, memory_order_relaxed );
+	io->cq_head = ( atomic_uint * )( cq + p->cq_off.head );
+	io->cq_tail = ( atomic_uint * )( cq + p->cq_off.tail );
+	io->cq_mask = *( unsigned * )( cq + p->cq_off.ring_mask );
+	io->cqes = ( struct io_uring_cqe * )( cq + p->cq_off.cqes );
+
+	/* submission queue entry i always sits in slot i */
+	unsigned *array = ( unsigned * )( sq + p->sq_off.array );
+	for ( unsigned i = 0; i < p->sq_entries; ++i )
+		array[ i ] = i;
+	return 0;
+}
+
+static void ringio_unmap( ringio_t *io )
+{
+	if ( io->sqes )
+		munmap( io->sqes, io->sqes_size );
+	if ( io->cq_map && io->cq_map != io->sq_map )
+		munmap( io->cq_map, io->cq_map_size );
+	if ( io->sq_map )
+		munmap( io->sq_map, io->sq_map_size );
+}
+
+/*
+ * Return the next submission queue entry, cleared, to be filled in and
+ * submitted by the next ringio_enter. There is always one: the queue
+ * has room for an operation and a cancellation per stream.
+ */
+static struct io_uring_sqe *ringio_sqe( ringio_t *io, uint64_t user_data )
+{
+	assert( io->sq_tail_local - atomic_load_explicit( io->sq_head, memory_order_acquire ) < io->sq_entries );
+	struct io_uring_sqe *sqe = &io->sqes[ io->sq_tail_local++ & io->sq_mask ];
+	memset( sqe, 0, sizeof( *sqe ) );
+	sqe->user_data = user_data;
+	++io->inflight;
+	return sqe;
+}
+
+/* Submit the new entries and wait for min_complete completions */
+static int ringio_enter( ringio_t *io, unsigned min_complete )
+{
+	atomic_store_explicit( io->sq_tail, io->sq_tail_local, memory_order_release );
+	unsigned to_submit = io->sq_tail_local - atomic_load_explicit( io->sq_head, memory_order_acquire );
+	if ( to_submit == 0 && min_complete == 0 )
+		return 0;
+	if ( syscall( __NR_io_uring_enter, io->ring_fd, to_submit, min_complete,
+			 min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0 )
+		< 0 )
+		return -1;
+	return 0;
+}
+
+/*
+ * Queue a stream's next operation: a readv into all of its ring
+ * buffer's free space, or a writev of all of its used space, if there
+ * is at least a batch of it, and otherwise a poll of the eventfd that
+ * the ring buffer signals when there is.
+ */
+static void ringio_start( ringio_t *io, int id )
+{
+	struct ringio_stream *s = &io->streams[ id ];
+	ringbuf_span_t span[ 2 ];
+	size_t n;
+
+	if ( s->kind == RINGIO_READ )
+		n = ringbuf_write_reserve( s->rb, SIZE_MAX, span );
+	else
+		n = ringbuf_read_peek( s->rb, SIZE_MAX, span );
+
+	s->busy = n < s->batch ? RINGIO_POLL : RINGIO_IO;
+	struct io_uring_sqe *sqe = ringio_sqe( io, ( uint64_t )id << 2 | ( uint64_t )s->busy );
+	if ( s->busy == RINGIO_POLL )
+	{
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = s->event;
+		sqe->poll32_events = POLLIN;
+		return;
+	}
+
+	for ( int i = 0; i < 2; ++i )
+	{
+		s->iov[ i ].iov_base = span[ i ].data;
+		s->iov[ i ].iov_len = span[ i ].len;
+	}
+	sqe->opcode = s->kind == RINGIO_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+	sqe->fd = s->fd;
+	sqe->addr = ( uintptr_t )s->iov;
+	sqe->len = span[ 1 ].len ? 2 : 1;
+	sqe->off = ( uint64_t )s->offset;
+}
+
+/*
+ * Handle a completion: commit or consume what was transferred, note
+ * the end of the file or an error, and clear the eventfd after a poll.
+ * A removed stream's slot is released with its last completion.
+ */
+static void ringio_complete( ringio_t *io, uint64_t user_data, int res )
+{
+	--io->inflight;
+	if ( user_data == RINGIO_CANCEL )
+		return;
+
+	struct ringio_stream *s = &io->streams[ user_data >> 2 ];
+	if ( ( user_data & 3 ) == RINGIO_POLL )
+	{
+		uint64_t count;
+		if ( read( s->event, &count, sizeof( count ) ) < 0 )
+			assert( errno == EAGAIN );
+	}
+	else if ( res > 0 )
+	{
+		if ( s->kind == RINGIO_READ )
+			ringbuf_write_commit( s->rb, ( size_t )res );
+		else
+			ringbuf_read_consume( s->rb, ( size_t )res );
+		if ( s->offset != -1 )
+			s->offset += res;
+	}
+	else if ( res == 0 && s->kind == RINGIO_READ )
+		s->status = 1;
+	else if ( res < 0 && res != -EAGAIN && res != -EINTR && res != -ECANCELED )
+		s->status = res;
+
+	s->busy = RINGIO_IDLE;
+	if ( s->removed )
+		s->kind = RINGIO_FREE;
+}
+
+ringio_t *ringio_new( int max_streams )
+{
+	assert( max_streams > 0 );
+	struct io_uring_params p;
+	ringio_t *io = calloc( 1, sizeof( ringio_t ) );
+	if ( !io )
+		return NULL;
+	io->max_streams = max_streams;
+	io->streams = calloc( ( size_t )max_streams, sizeof( struct ringio_stream ) );
+	if ( !io->streams )
+	{
+		free( io );
+		return NULL;
+	}
+
+	/* room for an operation and a cancellation per stream */
+	memset( &p, 0, sizeof( p ) );
+	io->ring_fd = ( int )syscall( __NR_io_uring_setup, 2 * ( unsigned )max_streams, &p );
+	if ( io->ring_fd < 0 || ringio_map( io, &p ) != 0 )
+	{
+		int err = errno;
+		ringio_unmap( io );
+		if ( io->ring_fd >= 0 )
+			close( io->ring_fd );
+		free( io->streams );
+		free( io );
+		errno = err;
+		return NULL;
+	}
+	return io;
+}
+
+void ringio_free( ringio_t *io )
+{
+	assert( io );
+	for ( int i = 0; i < io->max_streams; ++i )
+	{
+		if ( io->streams[ i ].kind != RINGIO_FREE && !io->streams[ i ].removed )
+			ringio_remove( io, i );
+	}
+	while ( io->inflight )
+	{
+		if ( ringio_run( io, 1 ) < 0 && errno != EINTR )
+			break;
+	}
+	ringio_unmap( io );
+	close( io->ring_fd );
+	free( io->streams );
+	free( io );
+}
+
+static int ringio_add( ringio_t *io, int kind, ringbuf_t *rb, int fd, off_t offset, size_t batch )
+{
+	/* the engine's thread is one side and the caller's the other */
+	if ( !( rb->flags & RINGBUF_SPSC ) || batch == 0 || batch > ringbuf_capacity( rb ) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	for ( int i = 0; i < io->max_streams; ++i )
+	{
+		struct ringio_stream *s = &io->streams[ i ];
+		if ( s->kind != RINGIO_FREE )
+			continue;
+
+		int event = kind == RINGIO_READ ? ringbuf_event_writable( rb, batch ) : ringbuf_event_readable( rb, batch );
+		if ( event < 0 )
+			return -1;
+		memset( s, 0, sizeof( *s ) );
+		s->rb = rb;
+		s->fd = fd;
+		s->event = event;
+		s->kind = kind;
+		s->offset = offset;
+		s->batch = batch;
+		return i;
+	}
+
+	errno = ENOSPC;
+	return -1;
+}
+
+int ringio_add_read( ringio_t *io, ringbuf_t *rb, int fd, off_t offset, size_t batch )
+{
+	return ringio_add( io, RINGIO_READ, rb, fd, offset, batch );
+}
+
+int ringio_add_write( ringio_t *io, ringbuf_t *rb, int fd, off_t offset, size_t batch )
+{
+	return ringio_add( io, RINGIO_WRITE, rb, fd, offset, batch );
+}
+
+void ringio_remove( ringio_t *io, int stream )
+{
+	struct ringio_stream *s = &io->streams[ stream ];
+	assert( s->kind != RINGIO_FREE && !s->removed );
+	if ( !s->busy )
+	{
+		s->kind = RINGIO_FREE;
+		return;
+	}
+
+	s->removed = 1;
+	struct io_uring_sqe *sqe = ringio_sqe( io, RINGIO_CANCEL );
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = ( uint64_t )stream << 2 | ( uint64_t )s->busy;
+}
+
+int ringio_status( const ringio_t *io, int stream )
+{
+	return io->streams[ stream ].status;
+}
+
+int ringio_busy( const ringio_t *io, int stream )
+{
+	return io->streams[ stream ].busy != RINGIO_IDLE;
+}
+
+int ringio_run( ringio_t *io, int wait )
+{
+	for ( int i = 0; i < io->max_streams; ++i )
+	{
+		struct ringio_stream *s = &io->streams[ i ];
+		if ( s->kind != RINGIO_FREE && s->busy == RINGIO_IDLE && !s->removed && s->status == 0 )
+			ringio_start( io, i );
+	}
+
+	if ( ringio_enter( io, wait && io->inflight ? 1 : 0 ) != 0 )
+		return -1;
+
+	int handled = 0;
+	unsigned head = atomic_load_explicit( io->cq_head, memory_order_relaxed );
+	unsigned tail = atomic_load_explicit( io->cq_tail, memory_order_acquire );
+	for ( ; head != tail; ++head, ++handled )
+	{
+		const struct io_uring_cqe *cqe = &io->cqes[ head & io->cq_mask ];
+		ringio_complete( io, cqe->user_data, cqe->res );
+	}
+	atomic_store_explicit( io->cq_head, head, memory_order_release );
+	return handled;
+}
+
+#else
+
+ringio_t *ringio_new( int max_streams )
+{
+	( void )max_streams;
+	errno = ENOSYS;
+	return NULL;
+}
+
+void ringio_free( ringio_t *io )
+{
+	( void )io;
+}
+
+int ringio_add_read( ringio_t *io, ringbuf_t *rb, int fd, off_t offset, size_t batch )
+{
+	( void )io;
+	( void )rb;
+	( void )fd;
+	( void )offset;
+	( void )batch;
+	errno = ENOSYS;
+	return -1;
+}
+
+int ringio_add_write( ringio_t *io, ringbuf_t *rb, int fd, off_t offset, size_t batch )
+{
+	return ringio_add_read( io, rb, fd, offset, batch );
+}
+
+void ringio_remove( ringio_t *io, int stream )
+{
+	( void )io;
+	( void )stream;
+}
+
+int ringio_status( const ringio_t *io, int stream )
+{
+	( void )io;
+	( void )stream;
+	return -ENOSYS;
+}
+
+int ringio_busy( const ringio_t *io, int stream )
+{
+	( void )io;
+	( void )stream;
+	return 0;
+}
+
+int ringio_run( ringio_t *io, int wait )
+{
+	( void )io;
+	( void )wait;
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif
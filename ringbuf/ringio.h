@@ -0,0 +1,126 @@
+#ifndef INCLUDED_RINGIO_H
+#define INCLUDED_RINGIO_H
+
+/*
+ * ringio.c - io_uring engine that fills and drains ring buffers.
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+/*
+ * A ringio_t keeps many streams between ring buffers and files (or
+ * pipes and sockets) moving from a single thread, without blocking in
+ * read or write. A read stream fills a ring buffer from a file: the
+ * engine is the ring buffer's producer, queues a readv into its free
+ * spans and commits what the read returned. A write stream drains a
+ * ring buffer into a file: the engine is its consumer, queues a writev
+ * of its used spans and consumes what was written. The other side of
+ * each ring buffer is an ordinary ringbuf_t producer or consumer on
+ * another thread, e.g. an audio callback.
+ *
+ * Each call to ringio_run queues the next operation of every stream
+ * that is ready for one and submits them all with one io_uring_enter,
+ * which also waits for and collects the completions. A stream whose
+ * ring buffer has too little room (or data) for its next operation
+ * instead waits on the ring buffer's eventfd (see
+ * ringbuf_event_writable and ringbuf_event_readable) through the same
+ * io_uring, so the engine sleeps until some file or some ring buffer
+ * is ready, and there is no system call per read or write.
+ *
+ * All ringio_* functions must be called from the one engine thread.
+ * Linux only; elsewhere ringio_new fails with ENOSYS.
+ */
+
+/* The header-only version needs ringio.c's feature macro up front */
+#if defined( RINGIO_IMPLEMENTATION ) && !defined( _GNU_SOURCE )
+#define _GNU_SOURCE
+#endif
+
+#include "ringbuf.h"
+
+#include <sys/types.h>
+
+typedef struct ringio_t ringio_t;
+
+/*
+ * Create an engine for up to max_streams streams at a time.
+ *
+ * Returns the new engine, or 0 with errno set by malloc or
+ * io_uring_setup (ENOSYS without io_uring).
+ */
+ringio_t *ringio_new( int max_streams );
+
+/*
+ * Cancel every stream, wait until the kernel has finished with all of
+ * their ring buffers and deallocate the engine. The ring buffers and
+ * files are left alone.
+ */
+void ringio_free( ringio_t *io );
+
+/*
+ * Start a stream that reads fd into rb (ringio_add_read) or writes rb
+ * out to fd (ringio_add_write). offset is the file offset of the first
+ * byte, which then advances with each transfer, or -1 to use (and
+ * move) the file position as read and write do, which is what pipes
+ * and sockets need.
+ *
+ * An operation is queued once at least batch bytes of rb are free
+ * (for a read) or used (for a write), and moves as many as there are
+ * then, so batch sets the smallest transfer. batch must be between 1
+ * and the capacity of rb; a write stream that must drain every last
+ * byte needs a batch of 1.
+ *
+ * The engine becomes the producer (for a read) or the consumer (for a
+ * write) of rb, and attaches rb's writable (or readable) eventfd with
+ * a mark of batch, so rb cannot be a shared memory ring buffer and its
+ * eventfd is not available for anything else. Add the stream before
+ * the other side starts using rb.
+ *
+ * Returns the stream's id, or -1 with errno set to ENOSPC if
+ * max_streams streams are running, EINVAL if rb was not created with
+ * RINGBUF_SPSC or batch is out of range, or by
+ * ringbuf_event_writable/readable.
+ */
+int ringio_add_read( ringio_t *io, ringbuf_t *rb, int fd, off_t offset, size_t batch );
+
+int ringio_add_write( ringio_t *io, ringbuf_t *rb, int fd, off_t offset, size_t batch );
+
+/*
+ * Stop a stream. An operation already in flight is cancelled (a read
+ * or write that the kernel has started may still complete, and is
+ * then committed as usual) and the id is only reused once it has
+ * completed, in a later ringio_run; rb must stay valid until then,
+ * which is once ringio_busy returns 0.
+ */
+void ringio_remove( ringio_t *io, int stream );
+
+/*
+ * The state of a stream: 0 while it runs, 1 once a read stream reached
+ * the end of its file, or a negative errno value once a read or write
+ * failed. A stream that has stopped stays stopped until removed.
+ */
+int ringio_status( const ringio_t *io, int stream );
+
+/*
+ * Whether the kernel may still be using the stream's ring buffer, i.e.
+ * an operation of the stream is in flight: 1 if so, else 0.
+ */
+int ringio_busy( const ringio_t *io, int stream );
+
+/*
+ * Queue the next operation of every ready stream, submit them, and
+ * commit whatever has completed. If wait is not 0 and any operation is
+ * in flight, first wait for at least one completion.
+ *
+ * Returns the number of completions handled, or -1 with errno set by
+ * io_uring_enter (e.g. EINTR, after which it can simply be called
+ * again).
+ */
+int ringio_run( ringio_t *io, int wait );
+
+// Include the implementation for a "header only" version of the library
+#ifdef RINGIO_IMPLEMENTATION
+#include "ringio.c"
+#endif
+
+#endif /* INCLUDED_RINGIO_H */
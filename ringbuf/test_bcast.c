@@ -0,0 +1,174 @@
+/*
+ * test_bcast.c - tests for bcast_ring_t.
+ *
+ * Exits with an assertion failure on the first test that fails.
+ */
+
+#include "bcast.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define STRESS_BYTES ( 4u << 20 )
+#define MAX_CHUNK 200
+#define NORMAL_READERS 2
+
+/* The byte at stream position pos */
+static uint8_t byte_at( size_t pos )
+{
+	return ( uint8_t )( pos * 7 + ( pos >> 8 ) );
+}
+
+static void fill( uint8_t *buf, size_t pos, size_t count )
+{
+	for ( size_t i = 0; i < count; ++i )
+		buf[ i ] = byte_at( pos + i );
+}
+
+static void check( const uint8_t *buf, size_t pos, size_t count )
+{
+	for ( size_t i = 0; i < count; ++i )
+		assert( buf[ i ] == byte_at( pos + i ) );
+}
+
+static void test_readers( void )
+{
+	bcast_ring_t *r = bcast_ring_new( 50, 2 );
+	uint8_t in[ 64 ], out[ 64 ];
+	size_t lost;
+	assert( r && bcast_ring_capacity( r ) == 64 );
+
+	int normal = bcast_ring_reader_add( r, 0 );
+	int lossy = bcast_ring_reader_add( r, BCAST_RING_LOSSY );
+	int extra = bcast_ring_reader_add( r, 0 );
+	assert( normal >= 0 && lossy >= 0 && extra == -1 );
+
+	/* the normal reader holds the producer back, the lossy one doesn't */
+	fill( in, 0, 64 );
+	size_t written = bcast_ring_write( r, in, 40 );
+	size_t read = bcast_ring_read( r, normal, out, 30, &lost );
+	assert( written == 40 && read == 30 && lost == 0 );
+	check( out, 0, 30 );
+	assert( bcast_ring_bytes_free( r ) == 54 );
+	fill( in, 40, 64 );
+	written = bcast_ring_write( r, in, 64 );
+	assert( written == 54 );
+
+	/* the lossy reader was overrun, and skips to the newest data */
+	assert( bcast_ring_bytes_used( r, lossy ) == 94 );
+	read = bcast_ring_read( r, lossy, out, 64, &lost );
+	assert( read == 0 && lost == 94 );
+	assert( bcast_ring_bytes_used( r, lossy ) == 0 );
+
+	bcast_span_t span[ 2 ];
+	size_t n = bcast_ring_read_peek( r, normal, 64, span );
+	assert( n == 64 && span[ 0 ].len + span[ 1 ].len == 64 );
+	check( span[ 0 ].data, 30, span[ 0 ].len );
+	check( span[ 1 ].data, 30 + span[ 0 ].len, span[ 1 ].len );
+	bcast_ring_read_consume( r, normal, n );
+	assert( bcast_ring_bytes_used( r, normal ) == 0 );
+
+	bcast_ring_reader_remove( r, lossy );
+	extra = bcast_ring_reader_add( r, 0 );
+	assert( extra == lossy );
+	bcast_ring_free( r );
+}
+
+typedef struct reader_arg_t
+{
+	bcast_ring_t *r;
+	int reader;
+	size_t lost;
+} reader_arg_t;
+
+static void *writer( void *p )
+{
+	bcast_ring_t *r = p;
+	uint8_t src[ MAX_CHUNK ];
+	size_t sent = 0;
+
+	while ( sent < STRESS_BYTES )
+	{
+		size_t count = sent % MAX_CHUNK + 1;
+		if ( count > STRESS_BYTES - sent )
+			count = STRESS_BYTES - sent;
+		fill( src, sent, count );
+		size_t n = bcast_ring_write( r, src, count );
+		assert( n <= count );
+		sent += n;
+		if ( n == 0 )
+			sched_yield();
+	}
+	return NULL;
+}
+
+/*
+ * Every reader, normal or lossy, must see each byte at its stream
+ * position, the lossy one counting the bytes it lost as read.
+ */
+static void *reader( void *p )
+{
+	reader_arg_t *a = p;
+	uint8_t dst[ MAX_CHUNK ];
+	size_t pos = 0;
+
+	while ( pos < STRESS_BYTES )
+	{
+		size_t count = pos % ( MAX_CHUNK - 3 ) + 1;
+		size_t lost;
+		size_t n = bcast_ring_read( a->r, a->reader, dst, count, &lost );
+		assert( n <= count );
+		pos += lost;
+		a->lost += lost;
+		check( dst, pos, n );
+		pos += n;
+		if ( n == 0 )
+			sched_yield();
+	}
+	assert( pos == STRESS_BYTES );
+	return NULL;
+}
+
+static void test_threads( void )
+{
+	bcast_ring_t *r = bcast_ring_new( 1024, NORMAL_READERS + 1 );
+	reader_arg_t a[ NORMAL_READERS + 1 ];
+	pthread_t tid[ NORMAL_READERS + 2 ];
+	assert( r );
+
+	for ( int i = 0; i <= NORMAL_READERS; ++i )
+	{
+		a[ i ].r = r;
+		a[ i ].reader = bcast_ring_reader_add( r, i == NORMAL_READERS ? BCAST_RING_LOSSY : 0 );
+		a[ i ].lost = 0;
+		assert( a[ i ].reader >= 0 );
+		pthread_create( &tid[ i ], NULL, reader, &a[ i ] );
+	}
+	pthread_create( &tid[ NORMAL_READERS + 1 ], NULL, writer, r );
+	for ( int i = 0; i < NORMAL_READERS + 2; ++i )
+		pthread_join( tid[ i ], NULL );
+	for ( int i = 0; i < NORMAL_READERS; ++i )
+		assert( a[ i ].lost == 0 );
+	bcast_ring_free( r );
+}
+
+/* A capacity that can't be rounded up is refused rather than wrapping */
+static void test_too_large( void )
+{
+	errno = 0;
+	bcast_ring_t *r = bcast_ring_new( SIZE_MAX, 1 );
+	assert( !r && errno == EINVAL );
+}
+
+int main( void )
+{
+	test_readers();
+	test_too_large();
+	test_threads();
+	printf( "bcast: ok\n" );
+	return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * test_blockpool.c - tests for blockpool_t.
+ *
+ * Exits with an assertion failure on the first test that fails.
+ */
+
+#include "blockpool.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NBLOCKS 64
+#define BLOCK_SIZE 100
+#define THREADS 4
+#define ROUNDS 100000
+
+/* Take every block there is, check they are distinct, and return them */
+static void drain( blockpool_t *p )
+{
+	void *blocks[ NBLOCKS ];
+	for ( int i = 0; i < NBLOCKS; ++i )
+	{
+		blocks[ i ] = blockpool_get( p );
+		assert( blocks[ i ] && ( uintptr_t )blocks[ i ] % 64 == 0 );
+		for ( int j = 0; j < i; ++j )
+			assert( blocks[ j ] != blocks[ i ] );
+	}
+	void *extra = blockpool_get( p );
+	assert( !extra );
+	for ( int i = 0; i < NBLOCKS; ++i )
+		blockpool_put( p, blocks[ i ] );
+}
+
+static void test_get_put( void )
+{
+	blockpool_t *p = blockpool_new( BLOCK_SIZE, NBLOCKS );
+	blockpool_cache_t c;
+	assert( p && blockpool_capacity( p ) == NBLOCKS && blockpool_block_size( p ) >= BLOCK_SIZE );
+	drain( p );
+
+	/* a cached block is an ordinary block of the pool */
+	blockpool_cache_init( &c, p );
+	void *block = blockpool_cache_get( &c );
+	assert( block );
+	blockpool_put( p, block );
+	blockpool_cache_flush( &c );
+	drain( p );
+	blockpool_free( p );
+}
+
+typedef struct worker_arg_t
+{
+	blockpool_t *pool;
+	int id;
+} worker_arg_t;
+
+/*
+ * Each worker fills the blocks it holds with its own id and checks
+ * them before giving them back, so a block handed to two threads at
+ * once shows up as the other's id.
+ */
+static void *worker( void *arg )
+{
+	worker_arg_t *w = arg;
+	blockpool_cache_t c;
+	int cached = w->id % 2;
+	uint8_t *held[ 3 ];
+
+	blockpool_cache_init( &c, w->pool );
+	for ( int round = 0; round < ROUNDS; ++round )
+	{
+		int n = 0;
+		while ( n < 3 )
+		{
+			held[ n ] = cached ? blockpool_cache_get( &c ) : blockpool_get( w->pool );
+			if ( held[ n ] )
+				memset( held[ n++ ], w->id, BLOCK_SIZE );
+			else
+				break;
+		}
+		if ( round % 64 == 0 )
+			sched_yield();
+		for ( int i = 0; i < n; ++i )
+		{
+			for ( int j = 0; j < BLOCK_SIZE; ++j )
+				assert( held[ i ][ j ] == w->id );
+			if ( cached )
+				blockpool_cache_put( &c, held[ i ] );
+			else
+				blockpool_put( w->pool, held[ i ] );
+		}
+	}
+	blockpool_cache_flush( &c );
+	return NULL;
+}
+
+static void test_threads( void )
+{
+	blockpool_t *p = blockpool_new( BLOCK_SIZE, NBLOCKS );
+	worker_arg_t w[ THREADS ];
+	pthread_t tid[ THREADS ];
+	assert( p );
+
+	for ( int i = 0; i < THREADS; ++i )
+	{
+		w[ i ].pool = p;
+		w[ i ].id = i + 1;
+		pthread_create( &tid[ i ], NULL, worker, &w[ i ] );
+	}
+	for ( int i = 0; i < THREADS; ++i )
+		pthread_join( tid[ i ], NULL );
+
+	/* nothing was lost or handed out twice */
+	drain( p );
+	blockpool_free( p );
+}
+
+int main( void )
+{
+	test_get_put();
+	test_threads();
+	printf( "blockpool: ok\n" );
+	return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * test_delayline.c - tests for delayline_t.
+ *
+ * Exits with an assertion failure on the first test that fails.
+ */
+
+#include "delayline.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define MAX_DELAY 300
+#define BLOCK 64
+#define BLOCKS 40
+
+/*
+ * The input is a ramp, which linear and cubic interpolation both
+ * reproduce exactly, so every read can be checked against the ramp
+ * value at the delayed position (or silence before the ramp started).
+ */
+static float ramp( float t )
+{
+	return t < 0 ? 0 : t + 1;
+}
+
+static void check( const float *out, size_t start, float delay, size_t count )
+{
+	for ( size_t n = 0; n < count; ++n )
+	{
+		float want = ramp( ( float )( start + n ) - delay );
+		float diff = out[ n ] - want;
+
+		/* near the start the interpolation straddles the silence */
+		if ( ( float )( start + n ) - delay >= 2 )
+			assert( diff > -1e-3f && diff < 1e-3f );
+	}
+}
+
+static void test_reads( int interp )
+{
+	delayline_t *dl = delayline_new( MAX_DELAY, BLOCK );
+	static const float delays[] = { 0, 1, 2.5f, 17.25f, 99.75f, MAX_DELAY };
+	float in[ BLOCK ], out[ BLOCK ], mod[ BLOCK ];
+	assert( dl && delayline_max_delay( dl ) >= MAX_DELAY );
+
+	for ( size_t b = 0; b < BLOCKS; ++b )
+	{
+		size_t start = b * BLOCK;
+		for ( size_t n = 0; n < BLOCK; ++n )
+			in[ n ] = ramp( ( float )( start + n ) );
+		delayline_write( dl, in, BLOCK );
+
+		for ( size_t i = 0; i < sizeof( delays ) / sizeof( delays[ 0 ] ); ++i )
+		{
+			delayline_read( dl, delays[ i ], interp, out, BLOCK );
+			check( out, start, delays[ i ], BLOCK );
+		}
+
+		/* a delay that sweeps across the block */
+		for ( size_t n = 0; n < BLOCK; ++n )
+			mod[ n ] = 10.5f + ( float )n * 0.75f;
+		delayline_read_mod( dl, mod, interp, out, BLOCK );
+		for ( size_t n = 0; n < BLOCK; ++n )
+			check( &out[ n ], start + n, mod[ n ], 1 );
+
+		/* two taps of gain 1 and 0.5 */
+		delayline_tap_t taps[ 2 ] = { { 5.5f, 1 }, { 40, 0.5f } };
+		delayline_read_taps( dl, taps, 2, interp, out, BLOCK );
+		for ( size_t n = 0; n < BLOCK; ++n )
+		{
+			float t = ( float )( start + n );
+			if ( t - 40 >= 2 )
+			{
+				float diff = out[ n ] - ( ramp( t - 5.5f ) + 0.5f * ramp( t - 40 ) );
+				assert( diff > -1e-3f && diff < 1e-3f );
+			}
+		}
+	}
+
+	delayline_reset( dl );
+	delayline_write( dl, in, BLOCK );
+	delayline_read( dl, MAX_DELAY, interp, out, BLOCK );
+	for ( size_t n = 0; n < BLOCK; ++n )
+		assert( out[ n ] == 0 );
+	delayline_free( dl );
+}
+
+/* Sizes whose sum can't be rounded up are refused rather than wrapping */
+static void test_too_large( void )
+{
+	errno = 0;
+	delayline_t *dl = delayline_new( SIZE_MAX, BLOCK );
+	assert( !dl && errno == EINVAL );
+	errno = 0;
+	dl = delayline_new( SIZE_MAX / 2, SIZE_MAX / 2 );
+	assert( !dl && errno == EINVAL );
+}
+
+int main( void )
+{
+	test_reads( DELAYLINE_LINEAR );
+	test_reads( DELAYLINE_CUBIC );
+	test_too_large();
+	printf( "delayline: ok\n" );
+	return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * test_elemring.c - tests for elemring_t.
+ *
+ * Exits with an assertion failure on the first test that fails.
+ */
+
+#include "elemring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* A multi-byte element, so a frame split at the wrap point would show */
+typedef struct frame_t
+{
+	uint32_t seq;
+	uint8_t check[ 3 ];
+} frame_t;
+
+#define STRESS_FRAMES 500000
+#define MAX_BATCH 100
+
+static void make_frame( frame_t *f, uint32_t seq )
+{
+	memset( f, 0, sizeof( *f ) );
+	f->seq = seq;
+	f->check[ 0 ] = f->check[ 1 ] = f->check[ 2 ] = ( uint8_t )seq;
+}
+
+static void check_frame( const frame_t *f, uint32_t seq )
+{
+	assert( f->seq == seq );
+	assert( f->check[ 0 ] == ( uint8_t )seq && f->check[ 1 ] == ( uint8_t )seq && f->check[ 2 ] == ( uint8_t )seq );
+}
+
+static void test_push_pop( void )
+{
+	elemring_t *er = elemring_new( 5, sizeof( frame_t ) );
+	frame_t in[ 8 ], out[ 8 ];
+	assert( er );
+	assert( elemring_capacity( er ) == 8 && elemring_elem_size( er ) == sizeof( frame_t ) );
+
+	for ( uint32_t i = 0; i < 8; ++i )
+		make_frame( &in[ i ], i );
+	size_t pushed = elemring_push( er, in, 6 );
+	size_t popped = elemring_pop( er, out, 4 );
+	assert( pushed == 6 && popped == 4 );
+	for ( uint32_t i = 0; i < 4; ++i )
+		check_frame( &out[ i ], i );
+
+	/* wraps, and is cut short at the capacity */
+	pushed = elemring_push( er, in, 8 );
+	assert( pushed == 6 && elemring_elems_free( er ) == 0 && elemring_elems_used( er ) == 8 );
+	popped = elemring_pop( er, out, 8 );
+	assert( popped == 8 );
+	check_frame( &out[ 0 ], 4 );
+	check_frame( &out[ 1 ], 5 );
+	for ( uint32_t i = 0; i < 6; ++i )
+		check_frame( &out[ 2 + i ], i );
+	popped = elemring_pop( er, out, 1 );
+	assert( popped == 0 );
+	elemring_free( er );
+
+	/* sizes that can't be rounded up or multiplied out are refused */
+	errno = 0;
+	er = elemring_new( SIZE_MAX, 1 );
+	assert( !er && errno == EINVAL );
+	errno = 0;
+	er = elemring_new( 1024, SIZE_MAX / 512 );
+	assert( !er && errno == EINVAL );
+}
+
+static void *producer( void *p )
+{
+	elemring_t *er = p;
+	frame_t batch[ MAX_BATCH ];
+	uint32_t sent = 0;
+
+	while ( sent < STRESS_FRAMES )
+	{
+		size_t count = sent % MAX_BATCH + 1;
+		if ( count > STRESS_FRAMES - sent )
+			count = STRESS_FRAMES - sent;
+		for ( size_t i = 0; i < count; ++i )
+			make_frame( &batch[ i ], sent + ( uint32_t )i );
+		size_t n = elemring_push( er, batch, count );
+		assert( n <= count );
+		sent += ( uint32_t )n;
+		if ( n == 0 )
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void test_spsc( void )
+{
+	elemring_t *er = elemring_new( 256, sizeof( frame_t ) );
+	frame_t batch[ MAX_BATCH ];
+	uint32_t received = 0;
+	pthread_t tid;
+	assert( er );
+
+	pthread_create( &tid, NULL, producer, er );
+	while ( received < STRESS_FRAMES )
+	{
+		size_t count = received % ( MAX_BATCH - 1 ) + 1;
+		size_t n = elemring_pop( er, batch, count );
+		assert( n <= count );
+		for ( size_t i = 0; i < n; ++i, ++received )
+			check_frame( &batch[ i ], received );
+		if ( n == 0 )
+			sched_yield();
+	}
+	pthread_join( tid, NULL );
+	assert( elemring_elems_used( er ) == 0 );
+	elemring_free( er );
+}
+
+int main( void )
+{
+	test_push_pop();
+	test_spsc();
+	printf( "elemring: ok\n" );
+	return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * test_mpmc.c - tests for mpmc_queue_t.
+ *
+ * Exits with an assertion failure on the first test that fails.
+ */
+
+#include "mpmc.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PRODUCERS 2
+#define CONSUMERS 2
+#define ITEMS 100000
+#define BATCH 8
+
+typedef struct item_t
+{
+	uint32_t producer;
+	uint32_t seq;
+} item_t;
+
+/* How often each item was popped */
+static atomic_uchar popped[ PRODUCERS ][ ITEMS ];
+static atomic_size_t total_popped;
+
+static void test_push_pop( void )
+{
+	mpmc_queue_t *q = mpmc_queue_new( sizeof( item_t ), 5 );
+	item_t in[ 8 ], out[ 8 ];
+	assert( q && mpmc_queue_capacity( q ) == 8 && mpmc_queue_item_size( q ) == sizeof( item_t ) );
+
+	for ( uint32_t i = 0; i < 8; ++i )
+		in[ i ] = ( item_t ){ 0, i };
+	int ok = mpmc_queue_push( q, &in[ 0 ] );
+	size_t n = mpmc_queue_push_batch( q, &in[ 1 ], 8 );
+	assert( ok && n == 7 );
+	ok = mpmc_queue_push( q, &in[ 0 ] );
+	assert( !ok && mpmc_queue_size( q ) == 8 );
+
+	ok = mpmc_queue_pop( q, &out[ 0 ] );
+	assert( ok && out[ 0 ].seq == 0 );
+	n = mpmc_queue_pop_batch( q, &out[ 1 ], 8 );
+	assert( n == 7 );
+	for ( uint32_t i = 0; i < 8; ++i )
+		assert( out[ i ].seq == i );
+	ok = mpmc_queue_pop( q, &out[ 0 ] );
+	assert( !ok && mpmc_queue_size( q ) == 0 );
+	mpmc_queue_free( q );
+
+	/* sizes that can't be rounded up or multiplied out are refused */
+	errno = 0;
+	q = mpmc_queue_new( 8, SIZE_MAX );
+	assert( !q && errno == EINVAL );
+	errno = 0;
+	q = mpmc_queue_new( SIZE_MAX / 4, 8 );
+	assert( !q && errno == EINVAL );
+}
+
+typedef struct worker_t
+{
+	mpmc_queue_t *q;
+	uint32_t id;
+} worker_t;
+
+/* Producers alternate between single and batched pushes */
+static void *producer( void *arg )
+{
+	worker_t *w = arg;
+	item_t batch[ BATCH ];
+	uint32_t seq = 0;
+
+	while ( seq < ITEMS )
+	{
+		size_t count = seq % 2 ? 1 : BATCH;
+		if ( count > ITEMS - seq )
+			count = ITEMS - seq;
+		for ( size_t i = 0; i < count; ++i )
+			batch[ i ] = ( item_t ){ w->id, seq + ( uint32_t )i };
+		size_t n = count == 1 ? ( size_t )mpmc_queue_push( w->q, batch ) : mpmc_queue_push_batch( w->q, batch, count );
+		seq += ( uint32_t )n;
+		if ( n == 0 )
+			sched_yield();
+	}
+	return NULL;
+}
+
+/*
+ * Each consumer must see every producer's items in the order they were
+ * pushed, and every item must be popped exactly once overall.
+ */
+static void *consumer( void *arg )
+{
+	worker_t *w = arg;
+	item_t batch[ BATCH ];
+	int64_t last[ PRODUCERS ];
+	for ( int p = 0; p < PRODUCERS; ++p )
+		last[ p ] = -1;
+
+	while ( atomic_load( &total_popped ) < ( size_t )PRODUCERS * ITEMS )
+	{
+		size_t n = w->id % 2 ? ( size_t )mpmc_queue_pop( w->q, batch ) : mpmc_queue_pop_batch( w->q, batch, BATCH );
+		for ( size_t i = 0; i < n; ++i )
+		{
+			item_t *it = &batch[ i ];
+			assert( it->producer < PRODUCERS && it->seq < ITEMS );
+			assert( ( int64_t )it->seq > last[ it->producer ] );
+			last[ it->producer ] = it->seq;
+			unsigned char seen = atomic_fetch_add( &popped[ it->producer ][ it->seq ], 1 );
+			assert( seen == 0 );
+		}
+		atomic_fetch_add( &total_popped, n );
+		if ( n == 0 )
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void test_threads( void )
+{
+	mpmc_queue_t *q = mpmc_queue_new( sizeof( item_t ), 64 );
+	worker_t w[ PRODUCERS + CONSUMERS ];
+	pthread_t tid[ PRODUCERS + CONSUMERS ];
+	assert( q );
+
+	for ( int i = 0; i < PRODUCERS + CONSUMERS; ++i )
+	{
+		w[ i ].q = q;
+		w[ i ].id = ( uint32_t )( i < PRODUCERS ? i : i - PRODUCERS );
+		pthread_create( &tid[ i ], NULL, i < PRODUCERS ? producer : consumer, &w[ i ] );
+	}
+	for ( int i = 0; i < PRODUCERS + CONSUMERS; ++i )
+		pthread_join( tid[ i ], NULL );
+
+	for ( int p = 0; p < PRODUCERS; ++p )
+		for ( int i = 0; i < ITEMS; ++i )
+			assert( atomic_load( &popped[ p ][ i ] ) == 1 );
+	assert( mpmc_queue_size( q ) == 0 );
+	mpmc_queue_free( q );
+}
+
+int main( void )
+{
+	test_push_pop();
+	test_threads();
+	printf( "mpmc: ok\n" );
+	return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * test_ring_cxx.cpp - tests for utils::ring.
+ *
+ * Exits with an assertion failure on the first test that fails.
+ */
+
+#include "ring.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define STRESS_ITEMS 1000000u
+#define MAX_BATCH 100u
+
+/* Counts live instances, so that leaked or doubly destroyed elements show */
+struct counted
+{
+	static inline int live = 0;
+	std::string value;
+
+	explicit counted( std::string v ) : value( std::move( v ) )
+	{
+		++live;
+	}
+	counted( const counted &other ) : value( other.value )
+	{
+		++live;
+	}
+	counted( counted &&other ) noexcept : value( std::move( other.value ) )
+	{
+		++live;
+	}
+	counted &operator=( counted && ) = default;
+	~counted()
+	{
+		--live;
+	}
+};
+
+static void test_full_empty()
+{
+	utils::ring<int, 8> r;
+	assert( r.empty() && r.capacity() == 8 );
+
+	for ( int i = 0; i < 8; ++i )
+	{
+		bool pushed = r.try_push( i );
+		assert( pushed );
+	}
+	bool pushed = r.try_push( 8 );
+	assert( !pushed && r.full() && r.size() == 8 );
+
+	int out = -1;
+	for ( int i = 0; i < 8; ++i )
+	{
+		bool popped = r.try_pop( out );
+		assert( popped && out == i );
+	}
+	bool popped = r.try_pop( out );
+	assert( !popped && out == 7 && r.empty() );
+}
+
+/* Bulk pushes and pops, peek and write_reserve split where the ring wraps */
+static void test_wrap()
+{
+	utils::ring<std::uint32_t, 8> r;
+	std::uint32_t in[ 8 ] = { 0, 1, 2, 3, 4, 5, 6, 7 }, out[ 8 ] = {};
+
+	std::size_t n = r.push( std::span<const std::uint32_t>( in, 5 ) );
+	std::size_t m = r.pop( std::span<std::uint32_t>( out, 5 ) );
+	assert( n == 5 && m == 5 && r.empty() );
+
+	/* front is at 5, so six elements wrap after three */
+	n = r.push( std::span<const std::uint32_t>( in, 6 ) );
+	assert( n == 6 && r.size() == 6 );
+	auto peeked = r.peek();
+	assert( peeked[ 0 ].size() == 3 && peeked[ 1 ].size() == 3 );
+	assert( peeked[ 0 ][ 0 ] == 0 && peeked[ 1 ][ 0 ] == 3 && peeked[ 1 ][ 2 ] == 5 );
+	r.consume( 4 );
+
+	/* the free space runs from 3 up to the front at 1, wrapping after 5 */
+	auto spans = r.write_reserve();
+	assert( spans[ 0 ].size() == 5 && spans[ 1 ].size() == 1 );
+	for ( std::size_t i = 0; i < 6; ++i )
+		( i < 5 ? spans[ 0 ][ i ] : spans[ 1 ][ i - 5 ] ) = 10 + ( std::uint32_t )i;
+	r.write_commit( 6 );
+	assert( r.full() );
+
+	/* cut short at the capacity */
+	n = r.push( std::span<const std::uint32_t>( in, 8 ) );
+	m = r.pop( std::span<std::uint32_t>( out, 8 ) );
+	assert( n == 0 && m == 8 && r.empty() );
+	assert( out[ 0 ] == 4 && out[ 1 ] == 5 );
+	for ( std::uint32_t i = 0; i < 6; ++i )
+		assert( out[ 2 + i ] == 10 + i );
+}
+
+/* A T that is not trivially copyable is constructed and destroyed, never copied as bytes */
+static void test_non_trivial()
+{
+	{
+		utils::ring<counted, 4> r;
+		std::vector<counted> in;
+		for ( int i = 0; i < 4; ++i )
+			in.emplace_back( std::string( 40, ( char )( 'a' + i ) ) );
+
+		std::size_t n = r.push( std::span<const counted>( in.data(), 3 ) );
+		assert( n == 3 && counted::live == 7 );
+		counted out( "" );
+		bool popped = r.try_pop( out );
+		assert( popped && out.value == in[ 0 ].value && counted::live == 7 );
+
+		/* wraps, and the moved-from elements that were not taken are left alone */
+		n = r.push_move( std::span<counted>( in.data() + 1, 3 ) );
+		assert( n == 2 && r.full() && in[ 3 ].value.size() == 40 );
+		bool emplaced = r.emplace( "x" );
+		assert( !emplaced );
+		std::vector<counted> rest( 2, counted( "" ) );
+		n = r.pop( rest );
+		assert( n == 2 && rest[ 0 ].value == std::string( 40, 'b' ) && rest[ 1 ].value == std::string( 40, 'c' ) );
+	}
+	/* the ring's destructor destroyed the two it still held */
+	assert( counted::live == 0 );
+}
+
+/* One producer and one consumer thread pass a sequence through a small ring */
+static void test_threads()
+{
+	static utils::ring<std::uint32_t, 256> r;
+
+	std::thread producer( [] {
+		std::uint32_t batch[ MAX_BATCH ], sent = 0;
+		while ( sent < STRESS_ITEMS )
+		{
+			std::uint32_t count = std::min( sent % MAX_BATCH + 1, STRESS_ITEMS - sent );
+			for ( std::uint32_t i = 0; i < count; ++i )
+				batch[ i ] = sent + i;
+			std::size_t n = r.push( std::span<const std::uint32_t>( batch, count ) );
+			sent += ( std::uint32_t )n;
+			if ( n == 0 )
+				std::this_thread::yield();
+		}
+	} );
+
+	std::uint32_t batch[ MAX_BATCH ], received = 0;
+	while ( received < STRESS_ITEMS )
+	{
+		std::size_t count = received % ( MAX_BATCH - 1 ) + 1;
+		std::size_t n = r.pop( std::span<std::uint32_t>( batch, count ) );
+		for ( std::size_t i = 0; i < n; ++i, ++received )
+			assert( batch[ i ] == received );
+		if ( n == 0 )
+			std::this_thread::yield();
+	}
+	producer.join();
+	assert( r.empty() );
+}
+
+int main()
+{
+	test_full_empty();
+	test_wrap();
+	test_non_trivial();
+	test_threads();
+	std::printf( "ring c++: ok\n" );
+	return 0;
+}
@@ -0,0 +1,1022 @@
+/*
+ * test_ringbuf.c - tests for ringbuf_t.
+ *
+ * Exits with an assertion failure on the first test that fails.
+ */
+
+#include "ringbuf.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define STRESS_BYTES ( 4u << 20 )
+
+/* The size of a record's header, and the alignment of records */
+#define HDR sizeof( size_t )
+
+typedef struct variant_t
+{
+	const char *name;
+	ringbuf_t *( *make )( size_t capacity, int flags );
+} variant_t;
+
+static ringbuf_t *make_plain( size_t capacity, int flags )
+{
+	if ( flags & ~RINGBUF_SPSC )
+		return ringbuf_new_ex( capacity, flags, NULL );
+	return flags & RINGBUF_SPSC ? ringbuf_new_spsc( capacity ) : ringbuf_new( capacity );
+}
+
+static const variant_t variants[] = {
+	{ "plain", make_plain },
+	{ "pow2", ringbuf_new_pow2 },
+	{ "mirrored", ringbuf_new_mirrored },
+};
+
+/* xorshift, so each thread has its own cheap random chunk sizes */
+static size_t next_rand( uint32_t *state )
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static void test_push_pop( const variant_t *v )
+{
+	ringbuf_t *rb = v->make( 100, 0 );
+	uint8_t in[ 64 ], out[ 64 ];
+	assert( rb );
+
+	for ( size_t i = 0; i < sizeof( in ); ++i )
+		in[ i ] = ( uint8_t )i;
+	for ( int round = 0; round < 10; ++round )
+	{
+		void *pushed = ringbuf_push_back( rb, in, sizeof( in ) );
+		assert( pushed && ringbuf_bytes_used( rb ) == sizeof( in ) );
+		void *popped = ringbuf_pop_front( out, rb, sizeof( out ) );
+		assert( popped && memcmp( in, out, sizeof( in ) ) == 0 );
+		assert( ringbuf_is_empty( rb ) );
+	}
+	void *popped = ringbuf_pop_front( out, rb, 1 );
+	assert( !popped );
+
+	/* fill it, then overflow it in two pushes: the newest capacity bytes are kept */
+	size_t cap = ringbuf_capacity( rb ), extra = 37;
+	uint8_t *seq = malloc( cap + extra ), *back = malloc( cap );
+	assert( seq && back );
+	for ( size_t i = 0; i < cap + extra; ++i )
+		seq[ i ] = ( uint8_t )( i * 7 );
+	void *pushed = ringbuf_push_back( rb, seq, cap );
+	assert( pushed && ringbuf_is_full( rb ) );
+	pushed = ringbuf_push_back( rb, seq + cap, 5 );
+	assert( pushed && ringbuf_is_full( rb ) );
+	pushed = ringbuf_push_back( rb, seq + cap + 5, extra - 5 );
+	assert( pushed && ringbuf_bytes_used( rb ) == cap );
+	popped = ringbuf_pop_front( back, rb, cap );
+	assert( popped && memcmp( back, seq + extra, cap ) == 0 && ringbuf_is_empty( rb ) );
+	free( back );
+	free( seq );
+	ringbuf_free( rb );
+}
+
+static void test_skip( const variant_t *v )
+{
+	ringbuf_t *rb = v->make( 64, RINGBUF_SPSC );
+	uint8_t in[ 16 ], out;
+	assert( rb );
+
+	for ( size_t i = 0; i < sizeof( in ); ++i )
+		in[ i ] = ( uint8_t )i;
+	void *pushed = ringbuf_push_back( rb, in, sizeof( in ) );
+	size_t skipped = ringbuf_skip( rb, 4 );
+	assert( pushed && skipped == 4 );
+	void *popped = ringbuf_pop_front( &out, rb, 1 );
+	assert( popped && out == 4 );
+	skipped = ringbuf_skip( rb, 100 );
+	assert( skipped == sizeof( in ) - 5 && ringbuf_is_empty( rb ) );
+	ringbuf_free( rb );
+}
+
+/*
+ * A file-backed ring buffer is recovered as it was left, an
+ * overflowing push included, and a corrupt one is refused.
+ */
+static void test_open_file( void )
+{
+	char path[] = "/tmp/test_ringbuf.XXXXXX";
+	int fd = mkstemp( path );
+	assert( fd >= 0 );
+	close( fd );
+	unlink( path );
+
+	/* a failed call leaves no file behind */
+	errno = 0;
+	ringbuf_t *rb = ringbuf_open_file( path, 0, 0 );
+	assert( !rb && errno == EINVAL && access( path, F_OK ) != 0 );
+
+	rb = ringbuf_open_file( path, 100, 0 );
+	assert( rb );
+	size_t capacity = ringbuf_capacity( rb );
+	uint8_t *in = malloc( 2 * capacity ), *out = malloc( capacity );
+	assert( capacity >= 100 && in && out );
+	for ( size_t i = 0; i < 2 * capacity; ++i )
+		in[ i ] = ( uint8_t )( i * 3 + ( i >> 8 ) );
+	void *pushed = ringbuf_push_back( rb, in, capacity / 2 );
+	assert( pushed );
+	pushed = ringbuf_push_back( rb, in + capacity / 2, capacity );
+	int r = ringbuf_sync( rb );
+	assert( pushed && r == 0 );
+
+	/* a waiter that never came back, and a cache written back torn */
+	atomic_store( &rb->ctl->read_want, 1 );
+	atomic_store( &rb->ctl->wait_enabled, 1 );
+	rb->ctl->front_cache = SIZE_MAX / 2;
+	ringbuf_free( rb );
+
+	rb = ringbuf_open_file( path, 0, 0 );
+	assert( rb && ringbuf_bytes_used( rb ) == capacity );
+	assert( atomic_load( &rb->ctl->read_want ) == 0 && atomic_load( &rb->ctl->wait_enabled ) == 0 );
+	assert( rb->ctl->front_cache == atomic_load( &rb->ctl->front ) );
+	void *popped = ringbuf_pop_front( out, rb, capacity );
+	assert( popped && memcmp( out, in + capacity / 2, capacity ) == 0 );
+
+	/* indices more than a buffer apart */
+	atomic_store( &rb->ctl->back, capacity + 1 );
+	atomic_store( &rb->ctl->front, 0 );
+	ringbuf_free( rb );
+	errno = 0;
+	rb = ringbuf_open_file( path, 0, 0 );
+	assert( !rb && errno == EINVAL && access( path, F_OK ) == 0 );
+	unlink( path );
+	free( in );
+	free( out );
+}
+
+/* Fill a record's payload from a seed, so that each record is different */
+static void fill_record( uint8_t *rec, size_t len, size_t seed )
+{
+	for ( size_t i = 0; i < len; ++i )
+		rec[ i ] = ( uint8_t )( seed * 31 + i );
+}
+
+static void check_record( const uint8_t *rec, size_t len, size_t seed )
+{
+	for ( size_t i = 0; i < len; ++i )
+		assert( rec[ i ] == ( uint8_t )( seed * 31 + i ) );
+}
+
+/*
+ * Records keep their boundaries, are stored contiguously across the
+ * wrap point behind padding, and are refused whole when they don't fit.
+ */
+static void test_records( const variant_t *v )
+{
+	static const size_t lens[] = { 0, 1, 7, 8, 9, 20 };
+	ringbuf_t *rb = v->make( 256, 0 );
+	assert( rb );
+	size_t capacity = ringbuf_capacity( rb ), size = ringbuf_buffer_capacity( rb );
+	/* the longest payload, header and padding to a size_t included */
+	size_t max = ( rb->flags & RINGBUF_MIRRORED ? capacity : capacity / 2 ) / HDR * HDR - HDR;
+	uint8_t *rec = malloc( capacity );
+	ringbuf_span_t span[ 8 ];
+	assert( rec );
+
+	/* round trip, one at a time and as a batch */
+	for ( size_t i = 0; i < sizeof( lens ) / sizeof( lens[ 0 ] ); ++i )
+	{
+		fill_record( rec, lens[ i ], i );
+		int pushed = ringbuf_record_push( rb, rec, lens[ i ] );
+		assert( pushed );
+	}
+	size_t len;
+	const void *peeked = ringbuf_record_peek( rb, &len );
+	assert( peeked && len == 0 );
+	size_t n = ringbuf_record_peek_batch( rb, span, 8 );
+	assert( n == sizeof( lens ) / sizeof( lens[ 0 ] ) );
+	for ( size_t i = 0; i < n; ++i )
+	{
+		assert( span[ i ].len == lens[ i ] );
+		check_record( span[ i ].data, lens[ i ], i );
+	}
+	ringbuf_record_consume( rb, n );
+	peeked = ringbuf_record_peek( rb, &len );
+	assert( ringbuf_is_empty( rb ) && !peeked );
+
+	/*
+	 * Records of varying size go round the buffer a few times. One that
+	 * does not fit before the end starts at the beginning of the buffer
+	 * instead, behind padding that counts as used.
+	 */
+	for ( size_t i = 0; i < 3 * size / 16; ++i )
+	{
+		size_t rec_len = 8 + i * 5 % 40, rec_size = HDR + ( rec_len + HDR - 1 ) / HDR * HDR;
+		size_t room = size - atomic_load( &rb->ctl->back ) % size;
+		int wraps = !( rb->flags & RINGBUF_MIRRORED ) && room < rec_size;
+		fill_record( rec, rec_len, i );
+		void *dst = ringbuf_record_reserve( rb, rec_len );
+		assert( dst && ( !wraps || dst == rb->buf + HDR ) );
+		memcpy( dst, rec, rec_len );
+		ringbuf_record_commit( rb, rec_len );
+		assert( ringbuf_bytes_used( rb ) == ( wraps ? room : 0 ) + rec_size );
+
+		peeked = ringbuf_record_peek( rb, &len );
+		assert( peeked == dst && len == rec_len );
+		check_record( peeked, len, i );
+		ringbuf_record_consume( rb, 1 );
+		assert( ringbuf_is_empty( rb ) );
+	}
+
+	/* a record larger than the free space is refused whole */
+	size_t pushed_count = 0;
+	fill_record( rec, 40, 0 );
+	while ( ringbuf_record_push( rb, rec, 40 ) )
+		++pushed_count;
+	size_t used = ringbuf_bytes_used( rb );
+	int pushed = ringbuf_record_push( rb, rec, 40 );
+	assert( pushed_count > 0 && !pushed && ringbuf_bytes_used( rb ) == used );
+	while ( ( n = ringbuf_record_peek_batch( rb, span, 8 ) ) != 0 )
+	{
+		for ( size_t i = 0; i < n; ++i )
+			assert( span[ i ].len == 40 );
+		ringbuf_record_consume( rb, n );
+		pushed_count -= n;
+	}
+	assert( pushed_count == 0 );
+	assert( ringbuf_is_empty( rb ) );
+
+	/* as is one larger than a record may ever be, even into an empty ring buffer */
+	pushed = ringbuf_record_push( rb, rec, max + 1 );
+	void *dst = ringbuf_record_reserve( rb, capacity + 1 );
+	assert( !pushed && !dst && ringbuf_is_empty( rb ) );
+	dst = ringbuf_record_reserve( rb, SIZE_MAX );
+	assert( !dst );
+	pushed = ringbuf_record_push( rb, rec, max );
+	assert( pushed );
+	ringbuf_free( rb );
+	free( rec );
+}
+
+/*
+ * Searches over data that wraps ten bytes in (eleven, with the
+ * sentinel byte of a plain ring buffer), so that "WXYZ" at offset 8
+ * straddles the wrap point.
+ */
+static void test_find( const variant_t *v )
+{
+	static const char data[] = ".AB.Q...WXYZ........R.........";
+	size_t used = sizeof( data ) - 1;
+	ringbuf_t *rb = v->make( 64, 0 );
+	assert( rb );
+	size_t skip = ringbuf_capacity( rb ) - 10;
+
+	/* move the front up to ten bytes short of the end of the buffer */
+	size_t set = ringbuf_memset( rb, 0, skip );
+	size_t skipped = ringbuf_skip( rb, skip );
+	assert( set == skip && skipped == skip );
+	void *pushed = ringbuf_push_back( rb, data, used );
+	assert( pushed );
+
+	size_t at = ringbuf_find_byte( rb, 'Q', 0 );
+	assert( at == 4 );
+	at = ringbuf_find_byte( rb, 'R', 0 );
+	assert( at == 20 );
+	at = ringbuf_find_byte( rb, 'Q', 5 );
+	assert( at == used );
+
+	/* in the first span, across the wrap point and in the second span */
+	at = ringbuf_find_pattern( rb, "AB", 2, 0 );
+	assert( at == 1 );
+	at = ringbuf_find_pattern( rb, "WXYZ", 4, 0 );
+	assert( at == 8 );
+	at = ringbuf_find_pattern( rb, "YZ..", 4, 0 );
+	assert( at == 10 );
+	at = ringbuf_find_pattern( rb, ".R.", 3, 0 );
+	assert( at == 19 );
+
+	/* not found: resume where the last len - 1 bytes start */
+	at = ringbuf_find_pattern( rb, "nope", 4, 0 );
+	assert( at == used - 3 );
+	at = ringbuf_find_pattern( rb, "WXYZ", 4, 9 );
+	assert( at == used - 3 );
+
+	/* an empty pattern matches at once */
+	at = ringbuf_find_pattern( rb, "", 0, 5 );
+	assert( at == 5 );
+	ringbuf_free( rb );
+}
+
+/*
+ * ringbuf_peek_at and ringbuf_copy_at read ahead of the front without
+ * consuming, across the wrap point of either ring buffer, and copy
+ * nothing when offset + count runs past the used bytes.
+ */
+static void test_peek_at( const variant_t *v )
+{
+	static const char data[] = "0123456789abcdefghijklmnopqrst";
+	size_t used = sizeof( data ) - 1;
+	char out[ 16 ];
+	ringbuf_t *rb = v->make( 64, 0 );
+	ringbuf_t *dst = v->make( 64, 0 );
+	assert( rb && dst );
+
+	/* the data wraps ten bytes in, dst's free space three bytes in */
+	size_t skip = ringbuf_capacity( rb ) - 10;
+	size_t set = ringbuf_memset( rb, 0, skip );
+	size_t skipped = ringbuf_skip( rb, skip );
+	assert( set == skip && skipped == skip );
+	skip = ringbuf_capacity( dst ) - 3;
+	set = ringbuf_memset( dst, 0, skip );
+	skipped = ringbuf_skip( dst, skip );
+	assert( set == skip && skipped == skip );
+	void *pushed = ringbuf_push_back( rb, data, used );
+	assert( pushed );
+
+	/* before, across and after the wrap point */
+	size_t n = ringbuf_peek_at( rb, 2, out, 5 );
+	assert( n == 5 && memcmp( out, data + 2, 5 ) == 0 );
+	n = ringbuf_peek_at( rb, 6, out, 8 );
+	assert( n == 8 && memcmp( out, data + 6, 8 ) == 0 );
+	n = ringbuf_peek_at( rb, 12, out, 16 );
+	assert( n == 16 && memcmp( out, data + 12, 16 ) == 0 );
+	n = ringbuf_peek_at( rb, used - 2, out, 2 );
+	assert( n == 2 && memcmp( out, data + used - 2, 2 ) == 0 );
+
+	/* out of range, including an offset + count that overflows */
+	memset( out, '#', sizeof( out ) );
+	n = ringbuf_peek_at( rb, used - 5, out, 6 );
+	assert( n == 0 && out[ 0 ] == '#' );
+	n = ringbuf_peek_at( rb, used + 1, out, 0 );
+	assert( n == 0 );
+	n = ringbuf_peek_at( rb, SIZE_MAX, out, 2 );
+	assert( n == 0 && out[ 0 ] == '#' );
+
+	/* from across rb's wrap point to across dst's */
+	void *head = ringbuf_copy_at( dst, rb, 6, 8 );
+	assert( head && ringbuf_bytes_used( dst ) == 8 && ringbuf_bytes_used( rb ) == used );
+	void *popped = ringbuf_pop_front( out, dst, 8 );
+	assert( popped && memcmp( out, data + 6, 8 ) == 0 );
+
+	head = ringbuf_copy_at( dst, rb, used - 5, 6 );
+	assert( !head && ringbuf_is_empty( dst ) );
+	head = ringbuf_copy_at( dst, rb, SIZE_MAX, 2 );
+	assert( !head && ringbuf_is_empty( dst ) && ringbuf_bytes_used( rb ) == used );
+
+	ringbuf_free( dst );
+	ringbuf_free( rb );
+}
+
+/*
+ * The statistics count bytes both ways, track the water marks, and
+ * record an overflow, with the bytes it overwrote, and the refusals.
+ */
+static void test_stats( const variant_t *v )
+{
+	uint8_t out[ 64 ];
+	ringbuf_stats_t st;
+	ringbuf_t *rb = v->make( 64, 0 );
+	assert( rb );
+	size_t cap = ringbuf_capacity( rb );
+	uint8_t *in = calloc( cap, 1 );
+	assert( in );
+	int r = ringbuf_stats_enable( rb );
+	assert( r == 0 );
+
+	void *pushed = ringbuf_push_back( rb, in, 40 );
+	void *popped = ringbuf_pop_front( out, rb, 30 );
+	assert( pushed && popped );
+	pushed = ringbuf_push_back( rb, in, 20 );
+	popped = ringbuf_pop_front( out, rb, 31 );
+	assert( pushed && !popped );
+	r = ringbuf_stats_snapshot( rb, &st );
+	assert( r == 0 && st.capacity == cap && st.bytes_used == 30 );
+	assert( st.bytes_in == 60 && st.bytes_out == 30 && st.pop_refusals == 1 );
+	assert( st.high_water == 40 && st.low_water == 10 && st.overflows == 0 && st.bytes_lost == 0 );
+	uint64_t pops = 0;
+	for ( int i = 0; i < RINGBUF_STATS_BINS; ++i )
+		pops += st.histogram[ i ];
+	assert( pops == 1 && st.histogram[ 10 * RINGBUF_STATS_BINS / ( cap + 1 ) ] == 1 );
+
+	/* cap - 10 bytes on top of 30 overwrite the oldest 20 */
+	pushed = ringbuf_push_back( rb, in, cap - 10 );
+	assert( pushed );
+	r = ringbuf_stats_snapshot( rb, &st );
+	assert( r == 0 && st.bytes_used == cap && st.high_water == cap );
+	assert( st.overflows == 1 && st.bytes_lost == 20 && st.bytes_in == 50 + cap && st.push_refusals == 0 );
+	ringbuf_free( rb );
+
+	/* an SPSC ring buffer refuses instead */
+	rb = v->make( 64, RINGBUF_SPSC );
+	assert( rb );
+	r = ringbuf_stats_enable( rb );
+	assert( r == 0 );
+	pushed = ringbuf_push_back( rb, in, 40 );
+	assert( pushed );
+	pushed = ringbuf_push_back( rb, in, cap - 39 );
+	assert( !pushed );
+	r = ringbuf_stats_snapshot( rb, &st );
+	assert( r == 0 && st.push_refusals == 1 && st.overflows == 0 && st.bytes_in == 40 && st.high_water == 40 );
+	ringbuf_free( rb );
+	free( in );
+}
+
+/*
+ * ringbuf_read_fd and ringbuf_write_fd move data through a non-blocking
+ * pipe. The data wraps ten bytes in, so both iovecs are used. EAGAIN
+ * and end of file are passed on.
+ */
+static void test_fd( const variant_t *v )
+{
+	static const char data[] = "0123456789abcdefghijklmnopqrst";
+	size_t len = sizeof( data ) - 1;
+	char out[ sizeof( data ) ];
+	int p[ 2 ];
+	int r = pipe( p );
+	assert( r == 0 );
+	for ( int i = 0; i < 2; ++i )
+	{
+		r = fcntl( p[ i ], F_SETFL, O_NONBLOCK );
+		assert( r == 0 );
+	}
+
+	ringbuf_t *rb = v->make( 64, 0 );
+	assert( rb );
+	size_t skip = ringbuf_capacity( rb ) - 10;
+	size_t set = ringbuf_memset( rb, 0, skip );
+	size_t skipped = ringbuf_skip( rb, skip );
+	assert( set == skip && skipped == skip );
+
+	/* nothing to read yet */
+	errno = 0;
+	ssize_t n = ringbuf_read_fd( rb, p[ 0 ], SIZE_MAX );
+	assert( n == -1 && errno == EAGAIN && ringbuf_is_empty( rb ) );
+
+	/* in across the wrap point, max respected */
+	n = write( p[ 1 ], data, len );
+	assert( n == ( ssize_t )len );
+	n = ringbuf_read_fd( rb, p[ 0 ], 4 );
+	assert( n == 4 );
+	n = ringbuf_read_fd( rb, p[ 0 ], SIZE_MAX );
+	assert( n == ( ssize_t )len - 4 && ringbuf_bytes_used( rb ) == len );
+
+	/* and out again, across the wrap point */
+	n = ringbuf_write_fd( rb, p[ 1 ], SIZE_MAX );
+	assert( n == ( ssize_t )len && ringbuf_is_empty( rb ) );
+	n = read( p[ 0 ], out, sizeof( out ) );
+	assert( n == ( ssize_t )len && memcmp( out, data, len ) == 0 );
+	n = ringbuf_write_fd( rb, p[ 1 ], SIZE_MAX );
+	assert( n == 0 );
+
+	/* a full pipe takes nothing and leaves the data in the ring buffer */
+	char fill[ 4096 ] = { 0 };
+	while ( write( p[ 1 ], fill, sizeof( fill ) ) > 0 )
+		;
+	void *pushed = ringbuf_push_back( rb, data, len );
+	errno = 0;
+	n = ringbuf_write_fd( rb, p[ 1 ], SIZE_MAX );
+	assert( pushed && n == -1 && errno == EAGAIN && ringbuf_bytes_used( rb ) == len );
+
+	/* end of file once the pipe is drained and closed */
+	close( p[ 1 ] );
+	while ( read( p[ 0 ], fill, sizeof( fill ) ) > 0 )
+		;
+	n = ringbuf_read_fd( rb, p[ 0 ], SIZE_MAX );
+	assert( n == 0 && ringbuf_bytes_used( rb ) == len );
+	close( p[ 0 ] );
+	ringbuf_free( rb );
+}
+
+/* Whether fd is readable right now, rearming it if so */
+static int event_fired( int fd )
+{
+	struct pollfd p = { fd, POLLIN, 0 };
+	uint64_t count;
+	if ( poll( &p, 1, 0 ) != 1 )
+		return 0;
+	ssize_t n = read( fd, &count, sizeof( count ) );
+	assert( n == sizeof( count ) && count > 0 );
+	return 1;
+}
+
+/*
+ * The eventfds fire when a push raises the used bytes, or a pop the
+ * free bytes, from below the mark to the mark or more, and not for
+ * anything that stays on one side of it or moves away from it.
+ */
+static void test_events( const variant_t *v )
+{
+	ringbuf_t *rb = v->make( 64, RINGBUF_SPSC );
+	uint8_t buf[ 64 ] = { 0 };
+	assert( rb );
+	size_t capacity = ringbuf_capacity( rb );
+
+	int rfd = ringbuf_event_readable( rb, 16 );
+	int wfd = ringbuf_event_writable( rb, capacity - 10 );
+	assert( rfd >= 0 && wfd >= 0 && rfd != wfd );
+	/* an empty ring buffer is writable from the start */
+	int rfired = event_fired( rfd ), wfired = event_fired( wfd );
+	assert( !rfired && wfired );
+
+	/* pushes below the read mark, across it, and above it */
+	void *pushed = ringbuf_push_back( rb, buf, 10 );
+	rfired = event_fired( rfd );
+	assert( pushed && !rfired );
+	pushed = ringbuf_push_back( rb, buf, 10 );
+	rfired = event_fired( rfd );
+	assert( pushed && rfired );
+	pushed = ringbuf_push_back( rb, buf, 10 );
+	rfired = event_fired( rfd );
+	/* pushes only take free space away */
+	wfired = event_fired( wfd );
+	assert( pushed && !rfired && !wfired );
+
+	/* pops below the write mark, across it, and above it */
+	void *popped = ringbuf_pop_front( buf, rb, 5 );
+	wfired = event_fired( wfd );
+	assert( popped && !wfired );
+	popped = ringbuf_pop_front( buf, rb, 20 );
+	wfired = event_fired( wfd );
+	assert( popped && wfired );
+	popped = ringbuf_pop_front( buf, rb, 3 );
+	wfired = event_fired( wfd );
+	/* pops only take used space away */
+	rfired = event_fired( rfd );
+	assert( popped && !wfired && !rfired );
+
+	/* moving the mark returns the same fd, signalled if already reached */
+	int fd = ringbuf_event_readable( rb, 2 );
+	rfired = event_fired( rfd );
+	assert( fd == rfd && rfired );
+	ringbuf_free( rb );
+}
+
+/* A capacity that can't be rounded up is refused rather than wrapping */
+static void test_too_large( const variant_t *v )
+{
+	errno = 0;
+	ringbuf_t *rb = v->make( SIZE_MAX / 2 + 2, 0 );
+	assert( !rb && errno == EINVAL );
+	errno = 0;
+	rb = v->make( SIZE_MAX, RINGBUF_SPSC );
+	assert( !rb && errno == EINVAL );
+}
+
+/*
+ * A RINGBUF_GROW ring buffer grows instead of overwriting, by doubling
+ * or to fit a push larger than that, and can't be made SPSC.
+ */
+static void test_grow( const variant_t *v )
+{
+	ringbuf_t *rb = v->make( 100, RINGBUF_GROW );
+	assert( rb );
+	size_t capacity = ringbuf_capacity( rb );
+	uint8_t *in = malloc( 8 * capacity ), *out = malloc( 8 * capacity );
+	assert( in && out );
+	for ( size_t i = 0; i < 8 * capacity; ++i )
+		in[ i ] = ( uint8_t )( i * 7 + ( i >> 8 ) );
+
+	/* wrap, fill, then overflow by one byte */
+	void *pushed = ringbuf_push_back( rb, in, capacity / 2 );
+	void *popped = ringbuf_pop_front( out, rb, capacity / 2 );
+	assert( pushed && popped );
+	pushed = ringbuf_push_back( rb, in, capacity );
+	assert( pushed && ringbuf_is_full( rb ) && ringbuf_capacity( rb ) == capacity );
+	pushed = ringbuf_push_back( rb, in + capacity, 1 );
+	assert( pushed && ringbuf_capacity( rb ) >= 2 * capacity && ringbuf_bytes_used( rb ) == capacity + 1 );
+
+	/* a push of more than twice the capacity grows to fit it */
+	pushed = ringbuf_push_back( rb, in + capacity + 1, 6 * capacity );
+	assert( pushed && ringbuf_bytes_used( rb ) == 7 * capacity + 1 );
+	assert( ringbuf_capacity( rb ) >= 7 * capacity + 1 );
+	popped = ringbuf_pop_front( out, rb, 7 * capacity + 1 );
+	assert( popped && memcmp( in, out, 7 * capacity + 1 ) == 0 && ringbuf_is_empty( rb ) );
+	ringbuf_free( rb );
+	free( in );
+	free( out );
+
+	/* growing would free the buffer under the consumer */
+	errno = 0;
+	rb = v->make( 100, RINGBUF_GROW | RINGBUF_SPSC );
+	assert( !rb && errno == EINVAL );
+}
+
+/* An allocator that counts its calls and can be told to fail */
+typedef struct counting_t
+{
+	size_t allocs;
+	size_t frees;
+	size_t bytes;
+	size_t max_align;
+	size_t fail_at;
+} counting_t;
+
+static void *counting_alloc( size_t size, size_t align, void *ctx )
+{
+	counting_t *c = ctx;
+	if ( ++c->allocs == c->fail_at )
+		return NULL;
+	c->bytes += size;
+	if ( align > c->max_align )
+		c->max_align = align;
+	if ( align <= sizeof( void * ) )
+		return malloc( size );
+	return aligned_alloc( align, ( size + align - 1 ) / align * align );
+}
+
+static void counting_free( void *ptr, size_t size, void *ctx )
+{
+	counting_t *c = ctx;
+	++c->frees;
+	c->bytes -= size;
+	free( ptr );
+}
+
+/* Push and pop a little through rb, to see that its buffer is usable */
+static void check_usable( ringbuf_t *rb )
+{
+	uint8_t in[ 32 ], out[ 32 ];
+	for ( size_t i = 0; i < sizeof( in ); ++i )
+		in[ i ] = ( uint8_t )( i + 1 );
+	void *pushed = ringbuf_push_back( rb, in, sizeof( in ) );
+	void *popped = ringbuf_pop_front( out, rb, sizeof( out ) );
+	assert( pushed && popped && memcmp( in, out, sizeof( in ) ) == 0 );
+}
+
+/*
+ * ringbuf_new_ex takes the ring buffer, its buffer and its statistics
+ * from the allocator and gives every byte back, including when it
+ * fails half way, and copes when the memory flags cannot be honoured.
+ */
+static void test_new_ex( void )
+{
+	counting_t c = { 0 };
+	ringbuf_allocator_t a = { counting_alloc, counting_free, &c };
+	size_t page = ( size_t )sysconf( _SC_PAGESIZE );
+
+	ringbuf_t *rb = ringbuf_new_ex( 100, RINGBUF_ALIGN_CACHELINE, &a );
+	assert( rb && c.allocs == 2 && c.max_align == RINGBUF_CACHELINE );
+	assert( ( uintptr_t )rb->buf % RINGBUF_CACHELINE == 0 );
+	check_usable( rb );
+	int r = ringbuf_stats_enable( rb );
+	assert( r == 0 && c.allocs == 3 );
+	ringbuf_free( rb );
+	assert( c.frees == 3 && c.bytes == 0 );
+
+	rb = ringbuf_new_ex( 100, RINGBUF_ALIGN_PAGE | RINGBUF_PREFAULT, &a );
+	assert( rb && c.max_align == page && ( uintptr_t )rb->buf % page == 0 );
+	check_usable( rb );
+	ringbuf_free( rb );
+	assert( c.frees == c.allocs && c.bytes == 0 );
+
+	/* the allocator is only asked for the alignment of huge pages */
+	rb = ringbuf_new_ex( 100, RINGBUF_HUGEPAGES, &a );
+	assert( rb && c.max_align == ( size_t )2 << 20 );
+	check_usable( rb );
+	ringbuf_free( rb );
+	assert( c.frees == c.allocs && c.bytes == 0 );
+
+	/* failing to allocate the buffer gives the ring buffer back */
+	for ( size_t fail = 1; fail <= 2; ++fail )
+	{
+		c = ( counting_t ){ .fail_at = fail };
+		errno = 0;
+		rb = ringbuf_new_ex( 100, 0, &a );
+		assert( !rb && errno == ENOMEM && c.allocs == fail && c.frees == fail - 1 && c.bytes == 0 );
+	}
+	c = ( counting_t ){ 0 };
+
+	/* huge pages fall back to transparent or normal pages where none are reserved */
+	rb = ringbuf_new_ex( 100, RINGBUF_HUGEPAGES | RINGBUF_PREFAULT, NULL );
+	assert( rb );
+	check_usable( rb );
+	ringbuf_free( rb );
+	rb = ringbuf_new_ex( 100, RINGBUF_HUGEPAGES | RINGBUF_MIRRORED, &a );
+	assert( rb && ringbuf_buffer_capacity( rb ) % page == 0 && c.allocs == 1 );
+	check_usable( rb );
+	ringbuf_free( rb );
+	assert( c.frees == 1 );
+
+	/*
+	 * Locking may be refused (RLIMIT_MEMLOCK, without CAP_IPC_LOCK),
+	 * in which case the ring buffer is not created and nothing leaks.
+	 */
+	rb = ringbuf_new_ex( 4096, RINGBUF_MLOCK, &a );
+	int err = errno;
+	if ( rb )
+	{
+		check_usable( rb );
+		ringbuf_free( rb );
+	}
+	else
+		assert( err == EPERM || err == ENOMEM || err == EAGAIN );
+	assert( c.frees == c.allocs && c.bytes == 0 );
+}
+
+/* Flags that are internal or unknown are refused */
+static void test_bad_flags( void )
+{
+	static const int bad[] = { 0x10000, 0x20000, 0x40000, 0x80000, 0x100000, 0x40000000 };
+	for ( size_t i = 0; i < sizeof( bad ) / sizeof( bad[ 0 ] ); ++i )
+	{
+		errno = 0;
+		ringbuf_t *rb = ringbuf_new_ex( 100, bad[ i ], NULL );
+		assert( !rb && errno == EINVAL );
+	}
+}
+
+/*
+ * ringbuf_reserve keeps the contents, wrapped or not, and does nothing
+ * when the ring buffer is already large enough.
+ */
+static void test_reserve( const variant_t *v )
+{
+	ringbuf_t *rb = v->make( 100, 0 );
+	assert( rb );
+	size_t capacity = ringbuf_capacity( rb );
+	uint8_t *in = malloc( capacity ), *out = malloc( capacity );
+	assert( in && out );
+	for ( size_t i = 0; i < capacity; ++i )
+		in[ i ] = ( uint8_t )( i * 5 + 1 );
+
+	void *pushed = ringbuf_push_back( rb, in, capacity / 2 );
+	void *popped = ringbuf_pop_front( out, rb, capacity / 2 );
+	assert( pushed && popped );
+	pushed = ringbuf_push_back( rb, in, capacity );
+	assert( pushed && ringbuf_is_full( rb ) );
+
+	const void *front = ringbuf_front( rb );
+	int r = ringbuf_reserve( rb, capacity / 2 );
+	assert( r == 0 && ringbuf_front( rb ) == front && ringbuf_capacity( rb ) == capacity );
+	r = ringbuf_reserve( rb, 3 * capacity );
+	assert( r == 0 && ringbuf_capacity( rb ) >= 3 * capacity && ringbuf_bytes_used( rb ) == capacity );
+	popped = ringbuf_pop_front( out, rb, capacity );
+	assert( popped && memcmp( in, out, capacity ) == 0 && ringbuf_is_empty( rb ) );
+	ringbuf_free( rb );
+	free( in );
+	free( out );
+}
+
+/* An unlinked temporary file to hold a shared memory ring buffer */
+static int temp_fd( void )
+{
+	char path[] = "/tmp/test_ringbuf.XXXXXX";
+	int fd = mkstemp( path );
+	assert( fd >= 0 );
+	unlink( path );
+	return fd;
+}
+
+/*
+ * The parent pushes a byte sequence into a shared memory ring buffer
+ * and a forked child attaches to it and pops the sequence, both
+ * sleeping on the shared futexes when they have to wait.
+ */
+static void test_shm_fork( int flags )
+{
+	int fd = temp_fd();
+	ringbuf_t *rb = ringbuf_new_shm( fd, 4096, flags );
+	assert( rb && ringbuf_capacity( rb ) == 4096 );
+	size_t total = STRESS_BYTES / 4;
+
+	pid_t pid = fork();
+	assert( pid >= 0 );
+	if ( pid == 0 )
+	{
+		uint8_t chunk[ 100 ];
+		ringbuf_t *child = ringbuf_attach_shm( fd );
+		if ( !child || ringbuf_capacity( child ) != 4096 )
+			_exit( 2 );
+		for ( size_t received = 0; received < total; )
+		{
+			size_t n = total - received < sizeof( chunk ) ? total - received : sizeof( chunk );
+			if ( ringbuf_wait_readable( child, n, -1 ) != 0 || !ringbuf_pop_front( chunk, child, n ) )
+				_exit( 3 );
+			for ( size_t i = 0; i < n; ++i, ++received )
+				if ( chunk[ i ] != ( uint8_t )( received * 7 ) )
+					_exit( 4 );
+		}
+		ringbuf_free( child );
+		_exit( 0 );
+	}
+
+	uint8_t chunk[ 64 ];
+	for ( size_t sent = 0; sent < total; sent += sizeof( chunk ) )
+	{
+		for ( size_t i = 0; i < sizeof( chunk ); ++i )
+			chunk[ i ] = ( uint8_t )( ( sent + i ) * 7 );
+		int r = ringbuf_wait_writable( rb, sizeof( chunk ), -1 );
+		void *pushed = ringbuf_push_back( rb, chunk, sizeof( chunk ) );
+		assert( r == 0 && pushed );
+	}
+	int status;
+	pid_t waited = waitpid( pid, &status, 0 );
+	assert( waited == pid && WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+	assert( ringbuf_is_empty( rb ) );
+	ringbuf_free( rb );
+	close( fd );
+}
+
+/*
+ * ringbuf_attach_shm refuses an object whose header does not carry the
+ * magic number and layout version; these are the two 32-bit words the
+ * header starts with.
+ */
+static void test_shm_attach_bad( void )
+{
+	int fd = temp_fd();
+
+	/* an empty object holds no ring buffer at all */
+	errno = 0;
+	ringbuf_t *rb = ringbuf_attach_shm( fd );
+	assert( !rb && errno == EINVAL );
+
+	rb = ringbuf_new_shm( fd, 4096, 0 );
+	assert( rb );
+	for ( off_t off = 0; off <= 4; off += 4 )
+	{
+		uint32_t word, bad;
+		ssize_t n = pread( fd, &word, sizeof( word ), off );
+		bad = word + 1;
+		ssize_t m = pwrite( fd, &bad, sizeof( bad ), off );
+		assert( n == sizeof( word ) && m == sizeof( bad ) );
+		errno = 0;
+		ringbuf_t *other = ringbuf_attach_shm( fd );
+		assert( !other && errno == EINVAL );
+
+		m = pwrite( fd, &word, sizeof( word ), off );
+		other = ringbuf_attach_shm( fd );
+		assert( m == sizeof( word ) && other );
+		ringbuf_free( other );
+	}
+	ringbuf_free( rb );
+	close( fd );
+}
+
+/* shrink_to_fit only reallocates when the buffer would get smaller */
+static void test_shrink_to_fit( const variant_t *v )
+{
+	ringbuf_t *rb = v->make( 20000, 0 );
+	uint8_t in[ 10 ] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 }, out[ 10 ];
+	assert( rb );
+
+	void *pushed = ringbuf_push_back( rb, in, sizeof( in ) );
+	int r = ringbuf_shrink_to_fit( rb );
+	assert( pushed && r == 0 );
+	assert( ringbuf_capacity( rb ) >= sizeof( in ) && ringbuf_capacity( rb ) < 20000 );
+
+	const void *front = ringbuf_front( rb );
+	size_t capacity = ringbuf_capacity( rb );
+	r = ringbuf_shrink_to_fit( rb );
+	assert( r == 0 && ringbuf_front( rb ) == front && ringbuf_capacity( rb ) == capacity );
+	void *popped = ringbuf_pop_front( out, rb, sizeof( out ) );
+	assert( popped && memcmp( in, out, sizeof( in ) ) == 0 );
+	ringbuf_free( rb );
+}
+
+typedef struct stress_arg_t
+{
+	ringbuf_t *rb;
+	size_t total;
+} stress_arg_t;
+
+/*
+ * The producer writes the byte sequence 0, 1, 2, ... through
+ * ringbuf_write_reserve in chunks of random size, checking that the
+ * spans never describe more than was asked for.
+ */
+static void *reserve_producer( void *p )
+{
+	stress_arg_t *a = p;
+	uint32_t seed = 1;
+	size_t sent = 0;
+
+	while ( sent < a->total )
+	{
+		ringbuf_span_t span[ 2 ];
+		size_t count = next_rand( &seed ) % 512 + 1;
+		if ( count > a->total - sent )
+			count = a->total - sent;
+		size_t n = ringbuf_write_reserve( a->rb, count, span );
+		assert( n <= count && span[ 0 ].len + span[ 1 ].len == n );
+		for ( int i = 0; i < 2; ++i )
+			for ( size_t j = 0; j < span[ i ].len; ++j )
+				( ( uint8_t * )span[ i ].data )[ j ] = ( uint8_t )sent++;
+		ringbuf_write_commit( a->rb, n );
+		if ( n == 0 )
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void test_reserve_peek_spsc( const variant_t *v )
+{
+	stress_arg_t a = { v->make( 1000, RINGBUF_SPSC ), STRESS_BYTES };
+	uint32_t seed = 2;
+	size_t received = 0;
+	pthread_t tid;
+	assert( a.rb );
+
+	pthread_create( &tid, NULL, reserve_producer, &a );
+	while ( received < a.total )
+	{
+		ringbuf_span_t span[ 2 ];
+		size_t count = next_rand( &seed ) % 512 + 1;
+		size_t n = ringbuf_read_peek( a.rb, count, span );
+		assert( n <= count && span[ 0 ].len + span[ 1 ].len == n );
+		for ( int i = 0; i < 2; ++i )
+			for ( size_t j = 0; j < span[ i ].len; ++j, ++received )
+				assert( ( ( uint8_t * )span[ i ].data )[ j ] == ( uint8_t )received );
+		ringbuf_read_consume( a.rb, n );
+		if ( n == 0 )
+			sched_yield();
+	}
+	pthread_join( tid, NULL );
+	assert( ringbuf_is_empty( a.rb ) );
+	ringbuf_free( a.rb );
+}
+
+/* The producer blocks in ringbuf_wait_writable when the ring is full */
+static void *wait_producer( void *p )
+{
+	stress_arg_t *a = p;
+	uint8_t chunk[ 64 ];
+	size_t sent = 0;
+
+	while ( sent < a->total )
+	{
+		for ( size_t i = 0; i < sizeof( chunk ); ++i )
+			chunk[ i ] = ( uint8_t )( sent + i );
+		int r = ringbuf_wait_writable( a->rb, sizeof( chunk ), -1 );
+		void *pushed = ringbuf_push_back( a->rb, chunk, sizeof( chunk ) );
+		assert( r == 0 && pushed );
+		sent += sizeof( chunk );
+	}
+	return NULL;
+}
+
+/*
+ * Both sides sleep on the futexes instead of spinning; a lost wakeup
+ * hangs the test.
+ */
+static void test_wait_spsc( const variant_t *v )
+{
+	stress_arg_t a = { v->make( 256, RINGBUF_SPSC ), STRESS_BYTES / 16 };
+	uint8_t chunk[ 32 ];
+	size_t received = 0;
+	pthread_t tid;
+	assert( a.rb );
+
+	pthread_create( &tid, NULL, wait_producer, &a );
+	while ( received < a.total )
+	{
+		int r = ringbuf_wait_readable( a.rb, sizeof( chunk ), -1 );
+		void *popped = ringbuf_pop_front( chunk, a.rb, sizeof( chunk ) );
+		assert( r == 0 && popped );
+		for ( size_t i = 0; i < sizeof( chunk ); ++i, ++received )
+			assert( chunk[ i ] == ( uint8_t )received );
+	}
+	pthread_join( tid, NULL );
+	ringbuf_free( a.rb );
+}
+
+int main( void )
+{
+	test_bad_flags();
+	test_new_ex();
+	test_open_file();
+	printf( "ringbuf file: ok\n" );
+	test_shm_attach_bad();
+	test_shm_fork( 0 );
+	test_shm_fork( RINGBUF_MIRRORED );
+	printf( "ringbuf shm: ok\n" );
+	for ( size_t i = 0; i < sizeof( variants ) / sizeof( variants[ 0 ] ); ++i )
+	{
+		const variant_t *v = &variants[ i ];
+		test_push_pop( v );
+		test_skip( v );
+		test_too_large( v );
+		test_grow( v );
+		test_reserve( v );
+		test_records( v );
+		test_find( v );
+		test_events( v );
+		test_peek_at( v );
+		test_stats( v );
+		test_fd( v );
+		test_shrink_to_fit( v );
+		test_reserve_peek_spsc( v );
+		test_wait_spsc( v );
+		printf( "ringbuf %s: ok\n", v->name );
+	}
+	return 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * test_ringbuf_cxx.cpp - checks that ringbuf.h compiles and links as C++.
+ *
+ * Exits with an assertion failure on the first test that fails.
+ */
+
+#include "ringbuf.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+int main()
+{
+	ringbuf_t *rb = ringbuf_new_spsc( 64 );
+	char out[ 6 ];
+	assert( rb );
+
+	void *pushed = ringbuf_push_back( rb, "hello", 6 );
+	assert( pushed && ringbuf_bytes_used( rb ) == 6 );
+	void *popped = ringbuf_pop_front( out, rb, sizeof( out ) );
+	assert( popped && std::strcmp( out, "hello" ) == 0 );
+	ringbuf_free( rb );
+	std::printf( "ringbuf c++: ok\n" );
+	return 0;
+}
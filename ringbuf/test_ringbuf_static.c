@@ -0,0 +1,115 @@
+/*
+ * test_ringbuf_static.c - tests for the header-only, static ringbuf_t:
+ * ringbuf_init on caller storage and RINGBUF_DECLARE. Built with
+ * RINGBUF_STATIC and RINGBUF_IMPLEMENTATION, so it links no ringbuf.o.
+ *
+ * Exits with an assertion failure on the first test that fails.
+ */
+
+#include "ringbuf.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+RINGBUF_DECLARE( events, 64 )
+
+/* A ring buffer set up by the initialiser alone, never pushed to */
+static uint8_t idle_storage[ 16 ];
+static ringbuf_t idle = RINGBUF_INITIALIZER( idle_storage, 16 );
+
+static void test_init( void )
+{
+	uint8_t storage[ 64 ], in[ 48 ], out[ 48 ];
+	ringbuf_t rb;
+	for ( size_t i = 0; i < sizeof( in ); ++i )
+		in[ i ] = ( uint8_t )( i * 3 + 1 );
+
+	int r = ringbuf_init( &rb, storage, sizeof( storage ), RINGBUF_SPSC | RINGBUF_POW2 );
+	assert( r == 0 && ringbuf_capacity( &rb ) == 64 && ringbuf_is_empty( &rb ) );
+
+	/* the second push wraps */
+	for ( int round = 0; round < 2; ++round )
+	{
+		void *pushed = ringbuf_push_back( &rb, in, sizeof( in ) );
+		void *popped = ringbuf_pop_front( out, &rb, sizeof( out ) );
+		assert( pushed && popped && memcmp( in, out, sizeof( in ) ) == 0 );
+	}
+	void *pushed = ringbuf_push_back( &rb, in, sizeof( in ) );
+	assert( pushed );
+	pushed = ringbuf_push_back( &rb, in, sizeof( in ) );
+	assert( !pushed && ringbuf_bytes_used( &rb ) == sizeof( in ) );
+
+	/* caller-owned storage is never reallocated */
+	errno = 0;
+	r = ringbuf_reserve( &rb, 1000 );
+	assert( r == -1 && errno == EINVAL );
+	ringbuf_free( &rb );
+
+	/* without RINGBUF_POW2 one byte is the sentinel */
+	r = ringbuf_init( &rb, storage, 10, 0 );
+	assert( r == 0 && ringbuf_capacity( &rb ) == 9 );
+	ringbuf_free( &rb );
+
+	errno = 0;
+	r = ringbuf_init( &rb, storage, 48, RINGBUF_POW2 );
+	assert( r == -1 && errno == EINVAL );
+	errno = 0;
+	r = ringbuf_init( &rb, storage, 64, RINGBUF_GROW );
+	assert( r == -1 && errno == EINVAL );
+}
+
+static void test_declare( void )
+{
+	uint8_t in[ 40 ], out[ 40 ];
+	for ( size_t i = 0; i < sizeof( in ); ++i )
+		in[ i ] = ( uint8_t )( 200 - i );
+
+	/* the fast paths, the second round across the wrap point */
+	for ( int round = 0; round < 3; ++round )
+	{
+		size_t pushed = events_push( in, sizeof( in ) );
+		assert( pushed == sizeof( in ) && ringbuf_bytes_used( &events ) == sizeof( in ) );
+		size_t popped = events_pop( out, sizeof( out ) );
+		assert( popped == sizeof( out ) && memcmp( in, out, sizeof( in ) ) == 0 );
+	}
+
+	/* refusals fall back to ringbuf_push_back and ringbuf_pop_front */
+	size_t popped = events_pop( out, 1 );
+	assert( popped == 0 );
+	size_t pushed = events_push( in, sizeof( in ) );
+	assert( pushed == sizeof( in ) );
+	pushed = events_push( in, sizeof( in ) );
+	assert( pushed == 0 && ringbuf_bytes_used( &events ) == sizeof( in ) );
+
+	/* statistics work on a declared ring buffer, and ringbuf_free releases them */
+	int r = ringbuf_stats_enable( &events );
+	assert( r == 0 );
+	popped = events_pop( out, sizeof( out ) );
+	assert( popped == sizeof( out ) && memcmp( in, out, sizeof( in ) ) == 0 );
+	ringbuf_stats_t st;
+	r = ringbuf_stats_snapshot( &events, &st );
+	assert( r == 0 && st.bytes_out == sizeof( out ) );
+	ringbuf_free( &events );
+	r = ringbuf_stats_snapshot( &events, &st );
+	assert( r == -1 );
+}
+
+/* RINGBUF_INITIALIZER leaves the allocator zeroed, which ringbuf_free must cope with */
+static void test_free_initializer( void )
+{
+	assert( !idle.alloc.alloc && !idle.alloc.free );
+	ringbuf_free( &idle );
+	assert( ringbuf_is_empty( &idle ) && ringbuf_capacity( &idle ) == 16 );
+}
+
+int main( void )
+{
+	test_init();
+	test_declare();
+	test_free_initializer();
+	printf( "ringbuf static: ok\n" );
+	return 0;
+}
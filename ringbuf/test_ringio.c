@@ -0,0 +1,157 @@
+/*
+ * test_ringio.c - tests for the ringio_t io_uring engine.
+ *
+ * Exits with an assertion failure on the first test that fails, and
+ * skips the tests where io_uring is not available.
+ */
+
+#include "ringio.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FILE_SIZE ( 1u << 20 )
+#define RING_SIZE ( 64u << 10 )
+#define CHUNK 1000
+
+static uint8_t byte_at( size_t pos )
+{
+	return ( uint8_t )( pos * 13 + ( pos >> 10 ) );
+}
+
+static int temp_file( void )
+{
+	char path[] = "/tmp/test_ringio.XXXXXX";
+	int fd = mkstemp( path );
+	assert( fd >= 0 );
+	unlink( path );
+	return fd;
+}
+
+/* Run the engine until a removed stream's last operation completed */
+static void drain( ringio_t *io, int stream )
+{
+	while ( ringio_busy( io, stream ) )
+	{
+		int r = ringio_run( io, 1 );
+		assert( r >= 0 || errno == EINTR );
+	}
+}
+
+/* Only an SPSC ring buffer can be shared with the engine's thread */
+static void test_add( ringio_t *io )
+{
+	ringbuf_t *rb = ringbuf_new( RING_SIZE );
+	assert( rb );
+	errno = 0;
+	int stream = ringio_add_read( io, rb, 0, 0, 1 );
+	assert( stream == -1 && errno == EINVAL );
+	ringbuf_free( rb );
+}
+
+/*
+ * A read stream fills the ring buffer from a file while this thread,
+ * as the consumer, drains it between calls to ringio_run.
+ */
+static void test_read( ringio_t *io )
+{
+	uint8_t *data = malloc( FILE_SIZE ), chunk[ CHUNK ];
+	int fd = temp_file();
+	size_t received = 0;
+	assert( data );
+	for ( size_t i = 0; i < FILE_SIZE; ++i )
+		data[ i ] = byte_at( i );
+	ssize_t nio = pwrite( fd, data, FILE_SIZE, 0 );
+	assert( nio == FILE_SIZE );
+
+	ringbuf_t *rb = ringbuf_new_spsc( RING_SIZE );
+	assert( rb );
+	int stream = ringio_add_read( io, rb, fd, 0, 4096 );
+	assert( stream >= 0 );
+
+	for ( ;; )
+	{
+		int r = ringio_run( io, 0 );
+		assert( r >= 0 );
+		size_t n = ringbuf_bytes_used( rb );
+		if ( n == 0 && ringio_status( io, stream ) == 1 )
+			break;
+		n = n < CHUNK ? n : CHUNK;
+		if ( n && ringbuf_pop_front( chunk, rb, n ) )
+		{
+			assert( received + n <= FILE_SIZE && memcmp( chunk, data + received, n ) == 0 );
+			received += n;
+		}
+	}
+	assert( received == FILE_SIZE );
+
+	ringio_remove( io, stream );
+	drain( io, stream );
+	ringbuf_free( rb );
+	close( fd );
+	free( data );
+}
+
+/*
+ * A write stream drains the ring buffer into a file while this thread,
+ * as the producer, keeps it topped up.
+ */
+static void test_write( ringio_t *io )
+{
+	uint8_t *data = malloc( FILE_SIZE ), chunk[ CHUNK ];
+	int fd = temp_file();
+	size_t sent = 0;
+	assert( data );
+
+	ringbuf_t *rb = ringbuf_new_spsc( RING_SIZE );
+	assert( rb );
+	int stream = ringio_add_write( io, rb, fd, 0, 1 );
+	assert( stream >= 0 );
+
+	while ( sent < FILE_SIZE || ringbuf_bytes_used( rb ) != 0 )
+	{
+		size_t n = FILE_SIZE - sent < CHUNK ? FILE_SIZE - sent : CHUNK;
+		if ( n && ringbuf_bytes_free( rb ) >= n )
+		{
+			for ( size_t i = 0; i < n; ++i )
+				chunk[ i ] = byte_at( sent + i );
+			void *pushed = ringbuf_push_back( rb, chunk, n );
+			assert( pushed );
+			sent += n;
+		}
+		int r = ringio_run( io, 0 );
+		assert( r >= 0 && ringio_status( io, stream ) == 0 );
+	}
+
+	ringio_remove( io, stream );
+	drain( io, stream );
+	ssize_t nio = pread( fd, data, FILE_SIZE, 0 );
+	assert( nio == FILE_SIZE );
+	for ( size_t i = 0; i < FILE_SIZE; ++i )
+		assert( data[ i ] == byte_at( i ) );
+	ringbuf_free( rb );
+	close( fd );
+	free( data );
+}
+
+int main( void )
+{
+	ringio_t *io = ringio_new( 2 );
+	if ( !io )
+	{
+		printf( "ringio: skipped (%s)\n", strerror( errno ) );
+		return 0;
+	}
+
+	test_add( io );
+	test_read( io );
+	test_write( io );
+	ringio_free( io );
+	printf( "ringio: ok\n" );
+	return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * test_triplebuf.c - tests for triplebuf_t.
+ *
+ * Exits with an assertion failure on the first test that fails.
+ */
+
+#include "triplebuf.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SNAPSHOTS 200000
+
+/* A snapshot big enough that a torn read would show */
+typedef struct snapshot_t
+{
+	uint32_t seq;
+	uint32_t copy[ 63 ];
+} snapshot_t;
+
+static void test_read_write( void )
+{
+	triplebuf_t *tb = triplebuf_new( sizeof( snapshot_t ) );
+	snapshot_t s = { 0 };
+	int fresh;
+	assert( tb && triplebuf_size( tb ) == sizeof( snapshot_t ) );
+
+	const snapshot_t *r = triplebuf_read( tb, &fresh );
+	assert( !fresh && r->seq == 0 );
+
+	/* only the newest of several snapshots is seen */
+	for ( s.seq = 1; s.seq <= 3; ++s.seq )
+		triplebuf_write( tb, &s );
+	r = triplebuf_read( tb, &fresh );
+	assert( fresh && r->seq == 3 );
+	r = triplebuf_read( tb, &fresh );
+	assert( !fresh && r->seq == 3 );
+
+	snapshot_t *w = triplebuf_write_buffer( tb );
+	w->seq = 4;
+	triplebuf_publish( tb );
+	r = triplebuf_read( tb, &fresh );
+	assert( fresh && r->seq == 4 );
+	triplebuf_free( tb );
+}
+
+static void *writer( void *p )
+{
+	triplebuf_t *tb = p;
+	for ( uint32_t seq = 1; seq <= SNAPSHOTS; ++seq )
+	{
+		snapshot_t *s = triplebuf_write_buffer( tb );
+		s->seq = seq;
+		for ( int i = 0; i < 63; ++i )
+			s->copy[ i ] = seq;
+		triplebuf_publish( tb );
+		if ( seq % 256 == 0 )
+			sched_yield();
+	}
+	return NULL;
+}
+
+/* The reader sees whole snapshots, never older than the last one */
+static void test_threads( void )
+{
+	triplebuf_t *tb = triplebuf_new( sizeof( snapshot_t ) );
+	uint32_t last = 0;
+	pthread_t tid;
+	assert( tb );
+
+	pthread_create( &tid, NULL, writer, tb );
+	while ( last < SNAPSHOTS )
+	{
+		int fresh;
+		const snapshot_t *s = triplebuf_read( tb, &fresh );
+		for ( int i = 0; i < 63; ++i )
+			assert( s->copy[ i ] == s->seq );
+		assert( fresh ? s->seq > last : s->seq == last );
+		last = s->seq;
+		if ( !fresh )
+			sched_yield();
+	}
+	pthread_join( tid, NULL );
+	triplebuf_free( tb );
+}
+
+int main( void )
+{
+	test_read_write();
+	test_threads();
+	printf( "triplebuf: ok\n" );
+	return 0;
+}
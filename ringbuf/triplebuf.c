@@ -0,0 +1,112 @@
+/*
+ * triplebuf.c - lock-free triple buffer for the latest value.
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+#include "triplebuf.h"
+#include "ringbuf_common.h"
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Set in middle when it holds a snapshot the reader has not taken */
+#define TRIPLEBUF_FRESH 4u
+
+/*
+ * Buffer i starts at buf + i * stride. back is the writer's buffer and
+ * front the reader's; middle holds the index of the third buffer, and
+ * TRIPLEBUF_FRESH when the writer put it there after the reader last
+ * took it. Both sides swap their buffer with the middle one by an
+ * exchange, whose release half hands their buffer over and whose
+ * acquire half makes the other side's writes to the buffer they get
+ * visible.
+ */
+struct triplebuf_t
+{
+	uint8_t *buf;
+	size_t size;
+	size_t stride;
+
+	/* Shared state */
+	alignas( RINGBUF_CACHELINE ) atomic_uint middle;
+
+	/* Writer state */
+	alignas( RINGBUF_CACHELINE ) unsigned back;
+
+	/* Reader state */
+	alignas( RINGBUF_CACHELINE ) unsigned front;
+};
+
+triplebuf_t *triplebuf_new( size_t size )
+{
+	triplebuf_t *tb = aligned_alloc( alignof( triplebuf_t ), sizeof( triplebuf_t ) );
+	if ( tb )
+	{
+		/* round up, so that the buffers do not share cache lines */
+		tb->stride = ( size + RINGBUF_CACHELINE - 1 ) / RINGBUF_CACHELINE * RINGBUF_CACHELINE;
+		if ( tb->stride == 0 )
+			tb->stride = RINGBUF_CACHELINE;
+		tb->size = size;
+		tb->buf = aligned_alloc( RINGBUF_CACHELINE, 3 * tb->stride );
+		if ( !tb->buf )
+		{
+			free( tb );
+			return NULL;
+		}
+		memset( tb->buf, 0, 3 * tb->stride );
+
+		tb->back = 0;
+		atomic_init( &tb->middle, 1 );
+		tb->front = 2;
+	}
+	return tb;
+}
+
+void triplebuf_free( triplebuf_t *tb )
+{
+	assert( tb );
+	free( tb->buf );
+	free( tb );
+}
+
+size_t triplebuf_size( const triplebuf_t *tb )
+{
+	return tb->size;
+}
+
+void *triplebuf_write_buffer( triplebuf_t *tb )
+{
+	return tb->buf + tb->back * tb->stride;
+}
+
+void triplebuf_publish( triplebuf_t *tb )
+{
+	unsigned old = atomic_exchange_explicit( &tb->middle, tb->back | TRIPLEBUF_FRESH, memory_order_acq_rel );
+	tb->back = old & ~TRIPLEBUF_FRESH;
+}
+
+void triplebuf_write( triplebuf_t *tb, const void *src )
+{
+	memcpy( triplebuf_write_buffer( tb ), src, tb->size );
+	triplebuf_publish( tb );
+}
+
+const void *triplebuf_read( triplebuf_t *tb, int *fresh )
+{
+	/* only the writer sets TRIPLEBUF_FRESH, so it cannot be lost in between */
+	int taken = 0;
+	if ( atomic_load_explicit( &tb->middle, memory_order_relaxed ) & TRIPLEBUF_FRESH )
+	{
+		unsigned old = atomic_exchange_explicit( &tb->middle, tb->front, memory_order_acq_rel );
+		tb->front = old & ~TRIPLEBUF_FRESH;
+		taken = 1;
+	}
+	if ( fresh )
+		*fresh = taken;
+	return tb->buf + tb->front * tb->stride;
+}
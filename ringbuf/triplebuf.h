@@ -0,0 +1,78 @@
+#ifndef INCLUDED_TRIPLEBUF_H
+#define INCLUDED_TRIPLEBUF_H
+
+/*
+ * triplebuf.c - lock-free triple buffer for the latest value.
+ *
+ * Licensed under the MIT licence <https://mit-license.org/>.
+ */
+
+/*
+ * A triple buffer hands the most recent snapshot of some state (meter
+ * levels, a spectrum frame, the playback position) from one writer
+ * thread to one reader thread. Unlike a FIFO it keeps no history: the
+ * reader always gets the newest complete snapshot, and snapshots it
+ * was too slow to see are simply replaced, never copied.
+ *
+ * There are three buffers of the same size. The writer fills its own
+ * back buffer and publishes it, which swaps it with the middle buffer;
+ * the reader, when a new snapshot has been published, swaps its front
+ * buffer with the middle one. Each swap is a single atomic exchange,
+ * so neither side ever waits for the other, and neither ever sees a
+ * buffer that the other is using.
+ */
+
+#include <stddef.h>
+
+typedef struct triplebuf_t triplebuf_t;
+
+/*
+ * Create a triple buffer of three buffers of size bytes each, aligned
+ * to a cache line and initially zero.
+ *
+ * Returns the new triple buffer, or 0 if there's not enough memory.
+ */
+triplebuf_t *triplebuf_new( size_t size );
+
+/*
+ * Deallocate a triple buffer. Neither thread may still be using it.
+ */
+void triplebuf_free( triplebuf_t *tb );
+
+size_t triplebuf_size( const triplebuf_t *tb );
+
+/*
+ * The writer's back buffer, to build the next snapshot in. Its contents
+ * are those of some older snapshot (or zero), not necessarily the last
+ * one published. Writer side.
+ */
+void *triplebuf_write_buffer( triplebuf_t *tb );
+
+/*
+ * Publish the back buffer as the newest snapshot. The writer gets a
+ * different back buffer, so pointers to the old one must not be used
+ * after this. Writer side.
+ */
+void triplebuf_publish( triplebuf_t *tb );
+
+/*
+ * Copy size bytes from src into the back buffer and publish it.
+ * Writer side.
+ */
+void triplebuf_write( triplebuf_t *tb, const void *src );
+
+/*
+ * Return the newest published snapshot, which stays valid and
+ * unchanged until the next call to triplebuf_read. If fresh is not 0
+ * it is set to 1 if this is a snapshot the reader has not seen before,
+ * and to 0 if nothing was published since the last call (or ever, in
+ * which case the buffer is zero). Reader side.
+ */
+const void *triplebuf_read( triplebuf_t *tb, int *fresh );
+
+// Include the implementation for a "header only" version of the library
+#ifdef TRIPLEBUF_IMPLEMENTATION
+#include "triplebuf.c"
+#endif
+
+#endif /* INCLUDED_TRIPLEBUF_H */